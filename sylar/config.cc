@@ -1,13 +1,99 @@
 #include "config.h"
+#include "scheduler.h"
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <fstream>
+#include <algorithm>
 
 namespace sylar
 {
+    thread_local std::vector<std::function<void()>> *ConfigVarBase::t_pendingListeners = nullptr;
+
+    void ConfigVarBase::NotifyListeners(std::function<void()> cb)
+    {
+        if (t_pendingListeners)
+        {
+            t_pendingListeners->push_back(std::move(cb));
+        }
+        else
+        {
+            cb();
+        }
+    }
+
+    void ConfigVarBase::ScheduleListeners(Scheduler *scheduler, std::function<void()> cb)
+    {
+        scheduler->schedule(std::move(cb));
+    }
+
+    /**
+     * 批量加载期间收集监听器,析构时统一执行
+     * 可以嵌套,只有最外层负责执行
+     */
+    class ListenerBatch
+    {
+    public:
+        ListenerBatch()
+        {
+            if (!ConfigVarBase::t_pendingListeners)
+            {
+                ConfigVarBase::t_pendingListeners = &m_cbs;
+            }
+        }
+
+        ~ListenerBatch()
+        {
+            if (ConfigVarBase::t_pendingListeners != &m_cbs)
+            {
+                return;
+            }
+            ConfigVarBase::t_pendingListeners = nullptr;
+            // 此时所有配置项都已是新值,监听器中修改配置会立即执行
+            // 在析构函数中执行,一个监听器抛出异常不能影响其他监听器
+            for (auto &cb : m_cbs)
+            {
+                try
+                {
+                    cb();
+                }
+                catch (std::exception &e)
+                {
+                    SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config listener exception: " << e.what();
+                }
+                catch (...)
+                {
+                    SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config listener unknown exception";
+                }
+            }
+        }
+
+    private:
+        std::vector<std::function<void()>> m_cbs;
+    };
+
     ConfigVarBase::ptr Config::LookupBase(const std::string &name)
     {
-        RWMutexType::ReadLock lock(GetMutex());
-        auto it = GetDatas().find(name);
+        Shard &shard = GetShard(name);
+        RWMutexType::ReadLock lock(shard.mutex);
+        auto it = shard.datas.find(name);
         // 如果找到的返回其值，找不到返回nullptr
-        return it == GetDatas().end() ? nullptr : it->second;
+        return it == shard.datas.end() ? nullptr : it->second;
+    }
+
+    ConfigVarBase::ptr Config::Register(ConfigVarBase::ptr var)
+    {
+        Shard &shard = GetShard(var->getName());
+        RWMutexType::WriteLock lock(shard.mutex);
+        auto it = shard.datas.emplace(var->getName(), var);
+        if (!it.second)
+        {
+            return it.first->second;
+        }
+        shard.index[var->getName()] = var;
+        return var;
     }
 
     static void ListAllMember(const std::string &prefix,
@@ -39,6 +125,7 @@ namespace sylar
 
     void Config::LoadFromYaml(const YAML::Node &root)
     {
+        ListenerBatch batch;
         // 结点类型<string,YAML::Node>
         std::list<std::pair<std::string, const YAML::Node>> all_nodes;
         // 将root中的结点进行解析，存放到all_nodes中
@@ -59,31 +146,419 @@ namespace sylar
             // 如果存在key才从文件中加载更新，不存在直接跳过
             if (var)
             {
-                if (i.second.IsScalar())
+                // 直接从结点加载,每个值只解析一次
+                var->fromNode(i.second);
+            }
+        }
+        // 即使没有配置项发生变化,也让缓存重新读取一次
+        ConfigVarBase::BumpGeneration();
+    }
+
+    /**
+     * 配置目录中已加载的文件
+     */
+    struct ConfFile
+    {
+        uint64_t mtime = 0;                     // 修改时间,纳秒
+        std::map<std::string, std::string> keys; // 上次加载时每个配置项的内容
+    };
+
+    static void ListYamlFiles(const std::string &path, std::vector<std::string> &files)
+    {
+        DIR *dir = opendir(path.c_str());
+        if (!dir)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Config opendir " << path << " failed errno=" << errno
+                                              << " " << strerror(errno);
+            return;
+        }
+        struct dirent *dp = nullptr;
+        while ((dp = readdir(dir)) != nullptr)
+        {
+            std::string name = dp->d_name;
+            size_t pos = name.rfind('.');
+            if (pos == std::string::npos)
+            {
+                continue;
+            }
+            std::string ext = name.substr(pos);
+            if (ext == ".yml" || ext == ".yaml")
+            {
+                files.push_back(path + "/" + name);
+            }
+        }
+        closedir(dir);
+        // 保证加载顺序固定
+        std::sort(files.begin(), files.end());
+    }
+
+    void Config::LoadFromConfDir(const std::string &path, bool force)
+    {
+        static Mutex s_mutex;
+        static std::map<std::string, ConfFile> s_files;
+
+        std::vector<std::string> files;
+        ListYamlFiles(path, files);
+
+        Mutex::Lock lock(s_mutex);
+        ListenerBatch batch;
+        for (auto &file : files)
+        {
+            struct stat st;
+            if (stat(file.c_str(), &st) != 0)
+            {
+                continue;
+            }
+            uint64_t mtime = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+            ConfFile &conf = s_files[file];
+            if (!force && conf.mtime == mtime)
+            {
+                // 文件没有变化
+                continue;
+            }
+
+            YAML::Node root;
+            try
+            {
+                root = YAML::LoadFile(file);
+            }
+            catch (std::exception &e)
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadConfFile file=" << file << " failed: " << e.what();
+                continue;
+            }
+
+            std::list<std::pair<std::string, const YAML::Node>> all_nodes;
+            ListAllMember("", root, all_nodes);
+            std::map<std::string, std::string> keys;
+            size_t changed = 0;
+            for (auto &i : all_nodes)
+            {
+                std::string key = i.first;
+                if (key.empty())
+                {
+                    continue;
+                }
+                std::transform(key.begin(), key.end(), key.begin(), ::tolower);
+                ConfigVarBase::ptr var = LookupBase(key);
+                if (!var)
+                {
+                    continue;
+                }
+                // 与上次加载的内容比较,没有变化的配置项不再解析
+                std::string text = YAML::Dump(i.second);
+                auto it = conf.keys.find(key);
+                if (!force && it != conf.keys.end() && it->second == text)
+                {
+                    keys[key] = std::move(text);
+                    continue;
+                }
+                if (var->fromNode(i.second))
+                {
+                    keys[key] = std::move(text);
+                    ++changed;
+                }
+                else if (it != conf.keys.end())
+                {
+                    // 加载失败只保留上次成功的内容,文件再次修改时重新解析
+                    keys[key] = it->second;
+                }
+            }
+            conf.keys.swap(keys);
+            conf.mtime = mtime;
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadConfFile file=" << file << " changed keys=" << changed;
+        }
+        ConfigVarBase::BumpGeneration();
+    }
+
+    /**
+     * 配置快照文件头,之后是count条记录:
+     * name_len(u32) + name + kind(u8) + data_len(u32) + data
+     */
+    struct SnapshotHeader
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint64_t schemaHash;
+        uint32_t count;
+        uint32_t reserved;
+        uint64_t sourceHash; // 生成快照时配置目录中文件列表的hash,0表示未记录
+    };
+
+    static const uint32_t SNAPSHOT_MAGIC = 0x53594353; // "SYCS"
+    static const uint32_t SNAPSHOT_VERSION = 2;
+    static const uint8_t SNAPSHOT_BINARY = 0; // toBinary编码
+    static const uint8_t SNAPSHOT_STRING = 1; // toString的结果
+
+    static void CollectVars(std::vector<ConfigVarBase::ptr> &vars)
+    {
+        Config::Visit([&vars](ConfigVarBase::ptr var)
+                      { vars.push_back(var); });
+    }
+
+    static const uint64_t FNV_OFFSET = 14695981039346656037ull;
+
+    // FNV-1a
+    static void FnvUpdate(uint64_t &hash, const void *data, size_t len)
+    {
+        const uint8_t *p = (const uint8_t *)data;
+        for (size_t i = 0; i < len; ++i)
+        {
+            hash ^= p[i];
+            hash *= 1099511628211ull;
+        }
+    }
+
+    // 按名称顺序累加每个配置项的名称和类型
+    static uint64_t SchemaHash(const std::vector<ConfigVarBase::ptr> &vars)
+    {
+        uint64_t hash = FNV_OFFSET;
+        for (auto &var : vars)
+        {
+            // 包含结尾的'\0',区分名称和类型的边界
+            FnvUpdate(hash, var->getName().c_str(), var->getName().size() + 1);
+            FnvUpdate(hash, var->getTypeName().c_str(), var->getTypeName().size() + 1);
+        }
+        return hash;
+    }
+
+    /**
+     * 配置目录中yaml文件列表的hash,累加每个文件的路径、大小和修改时间
+     * 文件增删、改名或被替换(即使修改时间更早)时都会变化
+     */
+    static uint64_t SourceHash(const std::string &path)
+    {
+        std::vector<std::string> files;
+        ListYamlFiles(path, files);
+        uint64_t hash = FNV_OFFSET;
+        for (auto &file : files)
+        {
+            struct stat st;
+            uint64_t meta[2] = {0, 0};
+            if (stat(file.c_str(), &st) == 0)
+            {
+                meta[0] = st.st_size;
+                meta[1] = st.st_mtim.tv_sec * 1000000000ull + st.st_mtim.tv_nsec;
+            }
+            FnvUpdate(hash, file.c_str(), file.size() + 1);
+            FnvUpdate(hash, meta, sizeof(meta));
+        }
+        // 0表示未记录
+        return hash ? hash : 1;
+    }
+
+    uint64_t Config::GetSchemaHash()
+    {
+        std::vector<ConfigVarBase::ptr> vars;
+        CollectVars(vars);
+        return SchemaHash(vars);
+    }
+
+    bool Config::SaveSnapshot(const std::string &path, uint64_t source_hash)
+    {
+        std::vector<ConfigVarBase::ptr> vars;
+        CollectVars(vars);
+
+        SnapshotHeader header;
+        memset(&header, 0, sizeof(header));
+        header.magic = SNAPSHOT_MAGIC;
+        header.version = SNAPSHOT_VERSION;
+        header.schemaHash = SchemaHash(vars);
+        header.count = vars.size();
+        header.sourceHash = source_hash;
+
+        std::string buf((const char *)&header, sizeof(header));
+        std::string data;
+        for (auto &var : vars)
+        {
+            data.clear();
+            uint8_t kind = SNAPSHOT_BINARY;
+            if (!var->toBinary(data))
+            {
+                kind = SNAPSHOT_STRING;
+                data = var->toString();
+            }
+            SnapshotCodec<std::string>::Encode(var->getName(), buf);
+            SnapshotCodec<uint8_t>::Encode(kind, buf);
+            SnapshotCodec<std::string>::Encode(data, buf);
+        }
+
+        // 先写临时文件再重命名,其他进程不会读到写了一半的快照
+        std::string tmp = path + ".tmp";
+        std::ofstream ofs(tmp, std::ios::binary | std::ios::trunc);
+        if (!ofs)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "SaveSnapshot open " << tmp << " failed";
+            return false;
+        }
+        ofs.write(buf.data(), buf.size());
+        ofs.close();
+        if (!ofs || rename(tmp.c_str(), path.c_str()) != 0)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "SaveSnapshot write " << path << " failed errno=" << errno
+                                              << " " << strerror(errno);
+            unlink(tmp.c_str());
+            return false;
+        }
+        return true;
+    }
+
+    bool Config::LoadSnapshot(const std::string &path, uint64_t source_hash)
+    {
+        int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(SnapshotHeader))
+        {
+            close(fd);
+            return false;
+        }
+        size_t size = st.st_size;
+        void *addr = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadSnapshot mmap " << path << " failed errno=" << errno
+                                              << " " << strerror(errno);
+            return false;
+        }
+        const char *begin = (const char *)addr;
+        const char *end = begin + size;
+        SnapshotHeader header;
+        memcpy(&header, begin, sizeof(header));
+
+        std::vector<ConfigVarBase::ptr> vars;
+        CollectVars(vars);
+        if (header.magic != SNAPSHOT_MAGIC || header.version != SNAPSHOT_VERSION ||
+            header.schemaHash != SchemaHash(vars) || header.count != vars.size())
+        {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadSnapshot " << path << " schema changed, ignore it";
+            munmap(addr, size);
+            return false;
+        }
+        if (source_hash && header.sourceHash != source_hash)
+        {
+            SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadSnapshot " << path << " config files changed, ignore it";
+            munmap(addr, size);
+            return false;
+        }
+
+        // 先检查整个文件,损坏时不修改任何配置项
+        struct Item
+        {
+            ConfigVarBase::ptr var;
+            uint8_t kind;
+            const char *data;
+            uint32_t len;
+        };
+        std::vector<Item> items;
+        items.reserve(header.count);
+        const char *p = begin + sizeof(header);
+        for (uint32_t i = 0; i < header.count; ++i)
+        {
+            uint32_t name_len = 0;
+            Item item;
+            if (!SnapshotCodec<uint32_t>::Decode(p, end, name_len) || (size_t)(end - p) < name_len)
+            {
+                break;
+            }
+            // schema hash相同时记录与已注册的配置项按名称顺序一一对应
+            if (vars[i]->getName().compare(0, std::string::npos, p, name_len) != 0)
+            {
+                break;
+            }
+            p += name_len;
+            if (!SnapshotCodec<uint8_t>::Decode(p, end, item.kind) ||
+                !SnapshotCodec<uint32_t>::Decode(p, end, item.len) || (size_t)(end - p) < item.len)
+            {
+                break;
+            }
+            item.var = vars[i];
+            item.data = p;
+            p += item.len;
+            items.push_back(item);
+        }
+        if (items.size() != header.count || p != end)
+        {
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "LoadSnapshot " << path << " corrupted";
+            munmap(addr, size);
+            return false;
+        }
+
+        {
+            ListenerBatch batch;
+            for (auto &i : items)
+            {
+                if (i.kind == SNAPSHOT_BINARY)
                 {
-                    // 将YAML::内结点值转为Scalar类型
-                    // 然后从字符串中加载（已通过实现偏特化实现了类型的转换），设置m_val，进行更新
-                    var->fromString(i.second.Scalar());
+                    i.var->fromBinary(i.data, i.len);
                 }
                 else
                 {
-                    // 其他类型,偏特化中fromString有对应的处理方法
-                    std::stringstream ss;
-                    ss << i.second;
-                    var->fromString(ss.str());
+                    i.var->fromString(std::string(i.data, i.len));
                 }
             }
         }
+        munmap(addr, size);
+        ConfigVarBase::BumpGeneration();
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "LoadSnapshot " << path << " keys=" << items.size();
+        return true;
+    }
+
+    void Config::LoadWithSnapshot(const std::string &path, const std::string &snapshot)
+    {
+        // 快照头中记录了生成时的文件列表hash,只比较修改时间会漏掉删除的文件和修改时间更早的文件
+        uint64_t source_hash = SourceHash(path);
+        if (LoadSnapshot(snapshot, source_hash))
+        {
+            return;
+        }
+        LoadFromConfDir(path, true);
+        SaveSnapshot(snapshot, source_hash);
     }
 
     void Config::Visit(std::function<void(ConfigVarBase::ptr)> cb)
     {
-        RWMutexType::ReadLock lock(GetMutex());
-        ConfigVarMap &m = GetDatas();
-        for (auto it = m.begin(); it != m.end(); ++it)
+        Visit("", cb);
+    }
+
+    void Config::Visit(const std::string &prefix, std::function<void(ConfigVarBase::ptr)> cb)
+    {
+        std::string name = prefix;
+        if (name.size() >= 2 && name.compare(name.size() - 2, 2, ".*") == 0)
+        {
+            name.resize(name.size() - 2);
+        }
+        std::vector<ConfigVarBase::ptr> vars;
+        Shard *shards = GetShards();
+        for (size_t i = 0; i < SHARD_COUNT; ++i)
+        {
+            RWMutexType::ReadLock lock(shards[i].mutex);
+            ConfigVarMap &m = shards[i].index;
+            // 有序索引中,以name开头的配置项是连续的一段
+            for (auto it = m.lower_bound(name); it != m.end(); ++it)
+            {
+                const std::string &key = it->first;
+                if (key.compare(0, name.size(), name) != 0)
+                {
+                    break;
+                }
+                if (name.empty() || key.size() == name.size() || key[name.size()] == '.')
+                {
+                    vars.push_back(it->second);
+                }
+            }
+        }
+        // 合并各分片的结果,名称唯一
+        std::sort(vars.begin(), vars.end(), [](const ConfigVarBase::ptr &a, const ConfigVarBase::ptr &b)
+                  { return a->getName() < b->getName(); });
+        for (auto &i : vars)
         {
-            cb(it->second);
+            cb(i);
         }
     }
 
-}
\ No newline at end of file
+}
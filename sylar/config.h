@@ -13,21 +13,118 @@
 #include <boost/lexical_cast.hpp>
 #include <yaml-cpp/yaml.h>
 #include <functional>
+#include <atomic>
+#include <type_traits>
+#include <cstring>
 #include "log.h"
 
 namespace sylar
 {
+    class ListenerBatch;
+    class Scheduler;
+
+    /**
+     * 配置项的约束,编译期定义
+     * static constexpr const char *s_modes[] = {"fast", "safe"};
+     * static constexpr sylar::ConfigSchema s_port_schema = sylar::ConfigSchema().range(1, 65535).reloadable(false);
+     * static constexpr sylar::ConfigSchema s_mode_schema = sylar::ConfigSchema().oneOf(s_modes);
+     */
+    class ConfigSchema
+    {
+    public:
+        constexpr ConfigSchema() {}
+
+        /**
+         * 数值类型的取值范围[min, max]
+         */
+        constexpr ConfigSchema range(double min, double max) const
+        {
+            ConfigSchema s = *this;
+            s.m_hasRange = true;
+            s.m_min = min;
+            s.m_max = max;
+            return s;
+        }
+
+        /**
+         * 可选值集合,按转成字符串后的结果比较
+         */
+        template <size_t N>
+        constexpr ConfigSchema oneOf(const char *const (&values)[N]) const
+        {
+            ConfigSchema s = *this;
+            s.m_enums = values;
+            s.m_enumCount = N;
+            return s;
+        }
+
+        /**
+         * 是否允许运行时重新加载,不允许时只有第一次加载生效
+         */
+        constexpr ConfigSchema reloadable(bool v) const
+        {
+            ConfigSchema s = *this;
+            s.m_reloadable = v;
+            return s;
+        }
+
+        constexpr bool hasRange() const { return m_hasRange; }
+        constexpr double getMin() const { return m_min; }
+        constexpr double getMax() const { return m_max; }
+        constexpr bool isReloadable() const { return m_reloadable; }
+
+        /**
+         * str是否在可选值集合中,没有设置集合时返回true
+         */
+        bool inEnums(const std::string &str) const
+        {
+            if (!m_enums)
+            {
+                return true;
+            }
+            for (size_t i = 0; i < m_enumCount; ++i)
+            {
+                if (str == m_enums[i])
+                {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        constexpr bool hasEnums() const { return m_enums != nullptr; }
+
+    private:
+        bool m_hasRange = false;
+        double m_min = 0;
+        double m_max = 0;
+        const char *const *m_enums = nullptr;
+        size_t m_enumCount = 0;
+        bool m_reloadable = true;
+    };
+
+    /**
+     * 每个类型一个唯一的地址,用于代替RTTI判断配置项的类型
+     */
+    template <class T>
+    const void *ConfigTypeId()
+    {
+        static const char s_id = 0;
+        return &s_id;
+    }
+
     /**
      * 存放一些公用的属性
      */
-    class ConfigVarBase
+    class ConfigVarBase : public std::enable_shared_from_this<ConfigVarBase>
     {
     public:
         typedef std::shared_ptr<ConfigVarBase> ptr;
 
-        ConfigVarBase(const std::string &name, const std::string &description)
+        ConfigVarBase(const std::string &name, const std::string &description, const void *type_id = nullptr)
             : m_name(name),
-              m_description(description)
+              m_description(description),
+              m_typeId(type_id)
         {
             // 转为小写
             std::transform(m_name.begin(), m_name.end(), m_name.begin(), ::tolower);
@@ -37,6 +134,22 @@ namespace sylar
         {
         }
 
+        /**
+         * 全局配置版本号,任意配置项被修改后加1
+         */
+        static uint64_t GetGeneration()
+        {
+            return Generation().load(std::memory_order_acquire);
+        }
+
+        /**
+         * 配置版本号加1,使所有ConfigCache失效
+         */
+        static void BumpGeneration()
+        {
+            Generation().fetch_add(1, std::memory_order_release);
+        }
+
         const std::string &getName() const
         {
             return m_name;
@@ -57,11 +170,92 @@ namespace sylar
          */
         virtual bool fromString(const std::string &val) = 0;
 
+        /**
+         * 转为YAML结点
+         */
+        virtual YAML::Node toNode() = 0;
+
+        /**
+         * 从YAML结点中加载,LoadFromYaml使用,不需要经过字符串
+         */
+        virtual bool fromNode(const YAML::Node &node) = 0;
+
         virtual std::string getTypeName() const = 0;
 
+        /**
+         * @brief 编码为二进制,用于配置快照
+         * @return 类型不支持二进制编码时返回false,快照中改为保存toString()的结果
+         */
+        virtual bool toBinary(std::string &) { return false; }
+
+        /**
+         * 从快照中的二进制加载,与fromString一样经过校验
+         */
+        virtual bool fromBinary(const char *, size_t) { return false; }
+
+        /**
+         * 类型标识,与ConfigTypeId<ConfigVar<T>>()比较
+         */
+        const void *getTypeId() const { return m_typeId; }
+
+        /**
+         * @brief 设置执行监听器的调度器,为nullptr时在修改配置的线程中执行
+         * 调度器执行时,连续的多次修改合并为一次,监听器只收到最后的值
+         * 调度器停止前需要重新设置为nullptr
+         */
+        void setListenerScheduler(Scheduler *scheduler) { m_scheduler = scheduler; }
+
+        /**
+         * 设置所有没有单独设置调度器的配置项默认使用的调度器
+         */
+        static void SetDefaultListenerScheduler(Scheduler *scheduler) { DefaultScheduler() = scheduler; }
+
+        /**
+         * 执行监听器的调度器,没有单独设置时使用默认调度器
+         */
+        Scheduler *getListenerScheduler() const
+        {
+            Scheduler *scheduler = m_scheduler;
+            return scheduler ? scheduler : DefaultScheduler().load();
+        }
+
+    protected:
+        /**
+         * 执行监听器,批量加载配置期间推迟到加载结束后统一执行
+         */
+        static void NotifyListeners(std::function<void()> cb);
+
+        /**
+         * 把监听器放到调度器中执行,实现在config.cc中,避免头文件依赖scheduler.h
+         */
+        static void ScheduleListeners(Scheduler *scheduler, std::function<void()> cb);
+
     protected:
         std::string m_name;        // 名称
         std::string m_description; // 描述
+        const void *m_typeId;      // 类型标识
+        std::atomic<Scheduler *> m_scheduler{nullptr}; // 执行监听器的调度器
+
+    private:
+        friend class Config;
+        friend class ListenerBatch;
+        // 当前线程正在批量加载时,推迟执行的监听器
+        static thread_local std::vector<std::function<void()>> *t_pendingListeners;
+
+        /**
+         * 放在静态方法里,避免全局变量初始化顺序的问题
+         */
+        static std::atomic<uint64_t> &Generation()
+        {
+            static std::atomic<uint64_t> s_generation{1};
+            return s_generation;
+        }
+
+        static std::atomic<Scheduler *> &DefaultScheduler()
+        {
+            static std::atomic<Scheduler *> s_scheduler{nullptr};
+            return s_scheduler;
+        }
     };
 
     /**
@@ -80,28 +274,67 @@ namespace sylar
         }
     };
 
+    /**
+     * 数据类型转换-YAML结点版本
+     * YAML::Node -> T
+     * 标量直接取字符串转换,其他没有结点版本的类型(如自定义类型)转为字符串后使用LexicalCast<std::string, T>
+     */
+    template <class T>
+    class LexicalCast<YAML::Node, T>
+    {
+    public:
+        T operator()(const YAML::Node &v)
+        {
+            if (v.IsScalar())
+            {
+                return LexicalCast<std::string, T>()(v.Scalar());
+            }
+            std::stringstream ss;
+            ss << v;
+            return LexicalCast<std::string, T>()(ss.str());
+        }
+    };
+
+    /**
+     * 数据类型转换-YAML结点版本
+     * T -> YAML::Node
+     */
+    template <class T>
+    class LexicalCast<T, YAML::Node>
+    {
+    public:
+        YAML::Node operator()(const T &v)
+        {
+            if constexpr (std::is_arithmetic<T>::value || std::is_same<T, std::string>::value)
+            {
+                // 标量不需要再解析
+                return YAML::Node(LexicalCast<T, std::string>()(v));
+            }
+            else
+            {
+                // 自定义类型的结果可能不是单个Scalar，所以需要进行YAML::Load
+                return YAML::Load(LexicalCast<T, std::string>()(v));
+            }
+        }
+    };
+
     // ***************vector start****************
 
     /**
      * 数据类型转换-vector偏特化版本
-     * string -> vector<T>
+     * YAML::Node -> vector<T>
      */
     template <class T>
-    class LexicalCast<std::string, std::vector<T>>
+    class LexicalCast<YAML::Node, std::vector<T>>
     {
     public:
-        std::vector<T> operator()(const std::string &v)
+        std::vector<T> operator()(const YAML::Node &node)
         {
-            // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
             typename std::vector<T> vec;
-            std::stringstream ss;
             for (size_t i = 0; i < node.size(); i++)
             {
-                ss.str(""); // 字符流置为空
-                ss << node[i];
-                // node[i]为一个基本类型string，需要将string转为T类型
-                vec.push_back(LexicalCast<std::string, T>()(ss.str()));
+                // 直接使用子结点转换,不再经过字符串
+                vec.push_back(LexicalCast<YAML::Node, T>()(node[i]));
             }
             return vec;
         }
@@ -109,23 +342,50 @@ namespace sylar
 
     /**
      * 数据类型转换-vector偏特化版本
-     * vector<T> -> string
+     * vector<T> -> YAML::Node
      */
     template <class T>
-    class LexicalCast<std::vector<T>, std::string>
+    class LexicalCast<std::vector<T>, YAML::Node>
     {
     public:
-        std::string operator()(const std::vector<T> &v)
+        YAML::Node operator()(const std::vector<T> &v)
         {
-            YAML::Node node;
-            // 将vector中的每一个元素变为yaml结点
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &i : v)
             {
-                // vector[i] 可能不是单个Scaler，所以需要进行YAML::Load
-                node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+                node.push_back(LexicalCast<T, YAML::Node>()(i));
             }
+            return node;
+        }
+    };
+
+    /**
+     * 数据类型转换-vector偏特化版本
+     * string -> vector<T>
+     */
+    template <class T>
+    class LexicalCast<std::string, std::vector<T>>
+    {
+    public:
+        std::vector<T> operator()(const std::string &v)
+        {
+            // loads the input string as a single YAML document
+            return LexicalCast<YAML::Node, std::vector<T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-vector偏特化版本
+     * vector<T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::vector<T>, std::string>
+    {
+    public:
+        std::string operator()(const std::vector<T> &v)
+        {
             std::stringstream ss;
-            ss << node;
+            ss << LexicalCast<std::vector<T>, YAML::Node>()(v);
             return ss.str();
         }
     };
@@ -136,24 +396,19 @@ namespace sylar
 
     /**
      * 数据类型转换-list偏特化版本
-     * string -> list<T>
+     * YAML::Node -> list<T>
      */
     template <class T>
-    class LexicalCast<std::string, std::list<T>>
+    class LexicalCast<YAML::Node, std::list<T>>
     {
     public:
-        std::list<T> operator()(const std::string &v)
+        std::list<T> operator()(const YAML::Node &node)
         {
-            // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
             typename std::list<T> vec;
-            std::stringstream ss;
             for (size_t i = 0; i < node.size(); i++)
             {
-                ss.str(""); // 字符流置为空
-                ss << node[i];
-                // node[i]为一个基本类型string，需要将string转为T类型
-                vec.push_back(LexicalCast<std::string, T>()(ss.str()));
+                // 直接使用子结点转换,不再经过字符串
+                vec.push_back(LexicalCast<YAML::Node, T>()(node[i]));
             }
             return vec;
         }
@@ -161,23 +416,50 @@ namespace sylar
 
     /**
      * 数据类型转换-list偏特化版本
-     * list<T> -> string
+     * list<T> -> YAML::Node
      */
     template <class T>
-    class LexicalCast<std::list<T>, std::string>
+    class LexicalCast<std::list<T>, YAML::Node>
     {
     public:
-        std::string operator()(const std::list<T> &v)
+        YAML::Node operator()(const std::list<T> &v)
         {
-            YAML::Node node;
-            // 将list中的每一个元素变为yaml结点
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &i : v)
             {
-                // list[i] 可能不是单个Scaler，所以需要进行YAML::Load
-                node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+                node.push_back(LexicalCast<T, YAML::Node>()(i));
             }
+            return node;
+        }
+    };
+
+    /**
+     * 数据类型转换-list偏特化版本
+     * string -> list<T>
+     */
+    template <class T>
+    class LexicalCast<std::string, std::list<T>>
+    {
+    public:
+        std::list<T> operator()(const std::string &v)
+        {
+            // loads the input string as a single YAML document
+            return LexicalCast<YAML::Node, std::list<T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-list偏特化版本
+     * list<T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::list<T>, std::string>
+    {
+    public:
+        std::string operator()(const std::list<T> &v)
+        {
             std::stringstream ss;
-            ss << node;
+            ss << LexicalCast<std::list<T>, YAML::Node>()(v);
             return ss.str();
         }
     };
@@ -188,24 +470,19 @@ namespace sylar
 
     /**
      * 数据类型转换-set偏特化版本
-     * string -> set<T>
+     * YAML::Node -> set<T>
      */
     template <class T>
-    class LexicalCast<std::string, std::set<T>>
+    class LexicalCast<YAML::Node, std::set<T>>
     {
     public:
-        std::set<T> operator()(const std::string &v)
+        std::set<T> operator()(const YAML::Node &node)
         {
-            // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
             typename std::set<T> vec;
-            std::stringstream ss;
             for (size_t i = 0; i < node.size(); i++)
             {
-                ss.str(""); // 字符流置为空
-                ss << node[i];
-                // node[i]为一个基本类型string，需要将string转为T类型
-                vec.insert(LexicalCast<std::string, T>()(ss.str()));
+                // 直接使用子结点转换,不再经过字符串
+                vec.insert(LexicalCast<YAML::Node, T>()(node[i]));
             }
             return vec;
         }
@@ -213,23 +490,50 @@ namespace sylar
 
     /**
      * 数据类型转换-set偏特化版本
-     * set<T> -> string
+     * set<T> -> YAML::Node
      */
     template <class T>
-    class LexicalCast<std::set<T>, std::string>
+    class LexicalCast<std::set<T>, YAML::Node>
     {
     public:
-        std::string operator()(const std::set<T> &v)
+        YAML::Node operator()(const std::set<T> &v)
         {
-            YAML::Node node;
-            // 将set中的每一个元素变为yaml结点
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &i : v)
             {
-                // set[i] 可能不是单个Scaler，所以需要进行YAML::Load
-                node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+                node.push_back(LexicalCast<T, YAML::Node>()(i));
             }
+            return node;
+        }
+    };
+
+    /**
+     * 数据类型转换-set偏特化版本
+     * string -> set<T>
+     */
+    template <class T>
+    class LexicalCast<std::string, std::set<T>>
+    {
+    public:
+        std::set<T> operator()(const std::string &v)
+        {
+            // loads the input string as a single YAML document
+            return LexicalCast<YAML::Node, std::set<T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-set偏特化版本
+     * set<T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::set<T>, std::string>
+    {
+    public:
+        std::string operator()(const std::set<T> &v)
+        {
             std::stringstream ss;
-            ss << node;
+            ss << LexicalCast<std::set<T>, YAML::Node>()(v);
             return ss.str();
         }
     };
@@ -240,24 +544,19 @@ namespace sylar
 
     /**
      * 数据类型转换-unordered_set偏特化版本
-     * string -> unordered_set<T>
+     * YAML::Node -> unordered_set<T>
      */
     template <class T>
-    class LexicalCast<std::string, std::unordered_set<T>>
+    class LexicalCast<YAML::Node, std::unordered_set<T>>
     {
     public:
-        std::unordered_set<T> operator()(const std::string &v)
+        std::unordered_set<T> operator()(const YAML::Node &node)
         {
-            // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
             typename std::unordered_set<T> vec;
-            std::stringstream ss;
             for (size_t i = 0; i < node.size(); i++)
             {
-                ss.str(""); // 字符流置为空
-                ss << node[i];
-                // node[i]为一个基本类型string，需要将string转为T类型
-                vec.insert(LexicalCast<std::string, T>()(ss.str()));
+                // 直接使用子结点转换,不再经过字符串
+                vec.insert(LexicalCast<YAML::Node, T>()(node[i]));
             }
             return vec;
         }
@@ -265,23 +564,50 @@ namespace sylar
 
     /**
      * 数据类型转换-unordered_set偏特化版本
-     * unordered_set<T> -> string
+     * unordered_set<T> -> YAML::Node
      */
     template <class T>
-    class LexicalCast<std::unordered_set<T>, std::string>
+    class LexicalCast<std::unordered_set<T>, YAML::Node>
     {
     public:
-        std::string operator()(const std::unordered_set<T> &v)
+        YAML::Node operator()(const std::unordered_set<T> &v)
         {
-            YAML::Node node;
-            // 将set中的每一个元素变为yaml结点
+            YAML::Node node(YAML::NodeType::Sequence);
             for (auto &i : v)
             {
-                // set[i] 可能不是单个Scaler，所以需要进行YAML::Load
-                node.push_back(YAML::Load(LexicalCast<T, std::string>()(i)));
+                node.push_back(LexicalCast<T, YAML::Node>()(i));
             }
+            return node;
+        }
+    };
+
+    /**
+     * 数据类型转换-unordered_set偏特化版本
+     * string -> unordered_set<T>
+     */
+    template <class T>
+    class LexicalCast<std::string, std::unordered_set<T>>
+    {
+    public:
+        std::unordered_set<T> operator()(const std::string &v)
+        {
+            // loads the input string as a single YAML document
+            return LexicalCast<YAML::Node, std::unordered_set<T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-unordered_set偏特化版本
+     * unordered_set<T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::unordered_set<T>, std::string>
+    {
+    public:
+        std::string operator()(const std::unordered_set<T> &v)
+        {
             std::stringstream ss;
-            ss << node;
+            ss << LexicalCast<std::unordered_set<T>, YAML::Node>()(v);
             return ss.str();
         }
     };
@@ -290,6 +616,44 @@ namespace sylar
 
     // ***************map start****************
 
+    /**
+     * 数据类型转换-map偏特化版本
+     * YAML::Node -> map<std::string,T>
+     */
+    template <class T>
+    class LexicalCast<YAML::Node, std::map<std::string, T>>
+    {
+    public:
+        std::map<std::string, T> operator()(const YAML::Node &node)
+        {
+            typename std::map<std::string, T> vec;
+            for (auto it = node.begin(); it != node.end(); it++)
+            {
+                vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<YAML::Node, T>()(it->second)));
+            }
+            return vec;
+        }
+    };
+
+    /**
+     * 数据类型转换-map偏特化版本
+     * map<std::string,T> -> YAML::Node
+     */
+    template <class T>
+    class LexicalCast<std::map<std::string, T>, YAML::Node>
+    {
+    public:
+        YAML::Node operator()(const std::map<std::string, T> &v)
+        {
+            YAML::Node node(YAML::NodeType::Map);
+            for (auto it = v.begin(); it != v.end(); it++)
+            {
+                node[it->first] = LexicalCast<T, YAML::Node>()(it->second);
+            }
+            return node;
+        }
+    };
+
     /**
      * 数据类型转换-map偏特化版本
      * string -> map<std::string,T>
@@ -301,98 +665,296 @@ namespace sylar
         std::map<std::string, T> operator()(const std::string &v)
         {
             // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
-            typename std::map<std::string, T> vec;
+            return LexicalCast<YAML::Node, std::map<std::string, T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-map偏特化版本
+     * map<std::string,T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::map<std::string, T>, std::string>
+    {
+    public:
+        std::string operator()(const std::map<std::string, T> &v)
+        {
             std::stringstream ss;
+            ss << LexicalCast<std::map<std::string, T>, YAML::Node>()(v);
+            return ss.str();
+        }
+    };
+
+    // ***************map end****************
+    // ***************unordered_map start****************
+
+    /**
+     * 数据类型转换-unordered_map偏特化版本
+     * YAML::Node -> unordered_map<std::string,T>
+     */
+    template <class T>
+    class LexicalCast<YAML::Node, std::unordered_map<std::string, T>>
+    {
+    public:
+        std::unordered_map<std::string, T> operator()(const YAML::Node &node)
+        {
+            typename std::unordered_map<std::string, T> vec;
             for (auto it = node.begin(); it != node.end(); it++)
             {
-                ss.str(""); // 字符流置为空
-                ss << it->second;
-                vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<std::string, T>()(ss.str())));
+                vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<YAML::Node, T>()(it->second)));
+            }
+            return vec;
+        }
+    };
+
+    /**
+     * 数据类型转换-unordered_map偏特化版本
+     * unordered_map<std::string,T> -> YAML::Node
+     */
+    template <class T>
+    class LexicalCast<std::unordered_map<std::string, T>, YAML::Node>
+    {
+    public:
+        YAML::Node operator()(const std::unordered_map<std::string, T> &v)
+        {
+            YAML::Node node(YAML::NodeType::Map);
+            for (auto it = v.begin(); it != v.end(); it++)
+            {
+                node[it->first] = LexicalCast<T, YAML::Node>()(it->second);
+            }
+            return node;
+        }
+    };
+
+    /**
+     * 数据类型转换-unordered_map偏特化版本
+     * string -> unordered_map<std::string,T>
+     */
+    template <class T>
+    class LexicalCast<std::string, std::unordered_map<std::string, T>>
+    {
+    public:
+        std::unordered_map<std::string, T> operator()(const std::string &v)
+        {
+            // loads the input string as a single YAML document
+            return LexicalCast<YAML::Node, std::unordered_map<std::string, T>>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * 数据类型转换-unordered_map偏特化版本
+     * unordered_map<std::string,T> -> string
+     */
+    template <class T>
+    class LexicalCast<std::unordered_map<std::string, T>, std::string>
+    {
+    public:
+        std::string operator()(const std::unordered_map<std::string, T> &v)
+        {
+            std::stringstream ss;
+            ss << LexicalCast<std::unordered_map<std::string, T>, YAML::Node>()(v);
+            return ss.str();
+        }
+    };
+
+    // ***************unordered_map end****************
+
+    /**
+     * 配置值的二进制编码,用于配置快照,不经过YAML和字符串
+     * 基础数值类型直接拷贝内存,字符串和容器为长度+内容
+     * SUPPORTED为false的类型(如自定义类型)在快照中保存为字符串
+     */
+    template <class T, class Enable = void>
+    class SnapshotCodec
+    {
+    public:
+        static const bool SUPPORTED = false;
+        static void Encode(const T &, std::string &) {}
+        static bool Decode(const char *&, const char *, T &) { return false; }
+    };
+
+    template <class T>
+    class SnapshotCodec<T, typename std::enable_if<std::is_arithmetic<T>::value>::type>
+    {
+    public:
+        static const bool SUPPORTED = true;
+        static void Encode(const T &v, std::string &out)
+        {
+            out.append((const char *)&v, sizeof(v));
+        }
+        static bool Decode(const char *&p, const char *end, T &v)
+        {
+            if ((size_t)(end - p) < sizeof(v))
+            {
+                return false;
+            }
+            memcpy(&v, p, sizeof(v));
+            p += sizeof(v);
+            return true;
+        }
+    };
+
+    template <>
+    class SnapshotCodec<std::string>
+    {
+    public:
+        static const bool SUPPORTED = true;
+        static void Encode(const std::string &v, std::string &out)
+        {
+            SnapshotCodec<uint32_t>::Encode(v.size(), out);
+            out.append(v);
+        }
+        static bool Decode(const char *&p, const char *end, std::string &v)
+        {
+            uint32_t len = 0;
+            if (!SnapshotCodec<uint32_t>::Decode(p, end, len) || (size_t)(end - p) < len)
+            {
+                return false;
+            }
+            v.assign(p, len);
+            p += len;
+            return true;
+        }
+    };
+
+    /**
+     * 序列式容器和集合: 元素个数+每个元素
+     */
+    template <class C, class E>
+    class SnapshotSeqCodec
+    {
+    public:
+        static const bool SUPPORTED = SnapshotCodec<E>::SUPPORTED;
+        static void Encode(const C &v, std::string &out)
+        {
+            SnapshotCodec<uint32_t>::Encode(v.size(), out);
+            for (auto &i : v)
+            {
+                SnapshotCodec<E>::Encode(i, out);
+            }
+        }
+        static bool Decode(const char *&p, const char *end, C &v)
+        {
+            uint32_t size = 0;
+            if (!SnapshotCodec<uint32_t>::Decode(p, end, size))
+            {
+                return false;
             }
-            return vec;
+            v.clear();
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                E e;
+                if (!SnapshotCodec<E>::Decode(p, end, e))
+                {
+                    return false;
+                }
+                v.insert(v.end(), std::move(e));
+            }
+            return true;
         }
     };
 
     /**
-     * 数据类型转换-map偏特化版本
-     * map<std::string,T> -> string
+     * map: 元素个数+每个键值对
      */
-    template <class T>
-    class LexicalCast<std::map<std::string, T>, std::string>
+    template <class C, class E>
+    class SnapshotMapCodec
     {
     public:
-        std::string operator()(const std::map<std::string, T> &v)
+        static const bool SUPPORTED = SnapshotCodec<E>::SUPPORTED;
+        static void Encode(const C &v, std::string &out)
         {
-            YAML::Node node;
-            // 将set中的每一个元素变为yaml结点
-            for (auto it = v.begin(); it != v.end(); it++)
+            SnapshotCodec<uint32_t>::Encode(v.size(), out);
+            for (auto &i : v)
             {
-                node[it->first] = YAML::Load(LexicalCast<T, std::string>()(it->second));
+                SnapshotCodec<std::string>::Encode(i.first, out);
+                SnapshotCodec<E>::Encode(i.second, out);
             }
-            std::stringstream ss;
-            ss << node;
-            return ss.str();
+        }
+        static bool Decode(const char *&p, const char *end, C &v)
+        {
+            uint32_t size = 0;
+            if (!SnapshotCodec<uint32_t>::Decode(p, end, size))
+            {
+                return false;
+            }
+            v.clear();
+            for (uint32_t i = 0; i < size; ++i)
+            {
+                std::string key;
+                E e;
+                if (!SnapshotCodec<std::string>::Decode(p, end, key) || !SnapshotCodec<E>::Decode(p, end, e))
+                {
+                    return false;
+                }
+                v.emplace(std::move(key), std::move(e));
+            }
+            return true;
         }
     };
 
-    // ***************map end****************
+    template <class T>
+    class SnapshotCodec<std::vector<T>> : public SnapshotSeqCodec<std::vector<T>, T>
+    {
+    };
 
-    // ***************unordered_map start****************
+    template <class T>
+    class SnapshotCodec<std::list<T>> : public SnapshotSeqCodec<std::list<T>, T>
+    {
+    };
 
-    /**
-     * 数据类型转换-unordered_map偏特化版本
-     * string -> unordered_map<std::string,T>
-     */
     template <class T>
-    class LexicalCast<std::string, std::unordered_map<std::string, T>>
+    class SnapshotCodec<std::set<T>> : public SnapshotSeqCodec<std::set<T>, T>
+    {
+    };
+
+    template <class T>
+    class SnapshotCodec<std::unordered_set<T>> : public SnapshotSeqCodec<std::unordered_set<T>, T>
+    {
+    };
+
+    template <class T>
+    class SnapshotCodec<std::map<std::string, T>> : public SnapshotMapCodec<std::map<std::string, T>, T>
+    {
+    };
+
+    template <class T>
+    class SnapshotCodec<std::unordered_map<std::string, T>>
+        : public SnapshotMapCodec<std::unordered_map<std::string, T>, T>
     {
-    public:
-        std::unordered_map<std::string, T> operator()(const std::string &v)
-        {
-            // loads the input string as a single YAML document
-            YAML::Node node = YAML::Load(v);
-            typename std::unordered_map<std::string, T> vec;
-            std::stringstream ss;
-            for (auto it = node.begin(); it != node.end(); it++)
-            {
-                ss.str(""); // 字符流置为空
-                ss << it->second;
-                vec.insert(std::make_pair(it->first.Scalar(), LexicalCast<std::string, T>()(ss.str())));
-            }
-            return vec;
-        }
     };
 
     /**
-     * 数据类型转换-unordered_map偏特化版本
-     * unordered_map<std::string,T> -> string
+     * 基础数值类型配置的原子副本,getValue直接读取,不需要操作引用计数
+     * 其他类型为空
      */
-    template <class T>
-    class LexicalCast<std::unordered_map<std::string, T>, std::string>
+    template <class T, bool = std::is_arithmetic<T>::value>
+    class ConfigVarScalar
     {
     public:
-        std::string operator()(const std::unordered_map<std::string, T> &v)
-        {
-            YAML::Node node;
-            // 将set中的每一个元素变为yaml结点
-            for (auto it = v.begin(); it != v.end(); it++)
-            {
-                node[it->first] = YAML::Load(LexicalCast<T, std::string>()(it->second));
-            }
-            std::stringstream ss;
-            ss << node;
-            return ss.str();
-        }
+        ConfigVarScalar(const T &) {}
     };
 
-    // ***************unordered_map end****************
+    template <class T>
+    class ConfigVarScalar<T, true>
+    {
+    public:
+        ConfigVarScalar(const T &v) : m_value(v) {}
+        T load() const { return m_value.load(std::memory_order_acquire); }
+        void store(const T &v) { m_value.store(v, std::memory_order_release); }
+
+    private:
+        std::atomic<T> m_value;
+    };
 
     // 重写operator()方法
     // FromStr T& operator()(const std::string&)
     // ToStr std::string operator()(const T&)
+    // FromNode T operator()(const YAML::Node&)
+    // ToNode YAML::Node operator()(const T&)
     // 特例化模板
-    template <class T, class FromStr = LexicalCast<std::string, T>, class ToStr = LexicalCast<T, std::string>>
+    template <class T, class FromStr = LexicalCast<std::string, T>, class ToStr = LexicalCast<T, std::string>,
+              class FromNode = LexicalCast<YAML::Node, T>, class ToNode = LexicalCast<T, YAML::Node>>
     class ConfigVar : public ConfigVarBase
     {
     public:
@@ -400,10 +962,51 @@ namespace sylar
         typedef RWMutex RWMutexType;
         typedef std::shared_ptr<ConfigVar> ptr;
         typedef std::function<void(const T &old_value, const T &new_value)> on_change_cb;
+        // 配置值的只读快照,持有期间不会被修改或释放
+        typedef std::shared_ptr<const T> Snapshot;
 
-        ConfigVar(const std::string &name, const T &val, const std::string &description = "")
-            : ConfigVarBase(name, description), m_val(val)
+        ConfigVar(const std::string &name, const T &val, const std::string &description = "",
+                  const ConfigSchema &schema = ConfigSchema())
+            : ConfigVarBase(name, description, ConfigTypeId<ConfigVar>()),
+              m_val(std::make_shared<const T>(val)),
+              m_scalar(val),
+              m_schema(schema)
         {
+            std::string err;
+            if (!validate(val, err))
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar name=" << m_name << " default value " << err;
+            }
+        }
+
+        const ConfigSchema &getSchema() const { return m_schema; }
+
+        /**
+         * @brief 按照schema检查值是否合法
+         * @param[out] err 不合法的原因
+         */
+        bool validate(const T &val, std::string &err) const
+        {
+            if constexpr (std::is_arithmetic<T>::value)
+            {
+                if (m_schema.hasRange() && (val < m_schema.getMin() || val > m_schema.getMax()))
+                {
+                    std::stringstream ss;
+                    ss << "value=" << val << " out of range [" << m_schema.getMin() << ", " << m_schema.getMax() << "]";
+                    err = ss.str();
+                    return false;
+                }
+            }
+            if (m_schema.hasEnums())
+            {
+                std::string str = ToStr()(val);
+                if (!m_schema.inEnums(str))
+                {
+                    err = "value=" + str + " not in enum set";
+                    return false;
+                }
+            }
+            return true;
         }
 
         /**
@@ -413,14 +1016,13 @@ namespace sylar
         {
             try
             {
-                RWMutexType::ReadLock lock(m_mutex);
-                return ToStr()(m_val);
+                return ToStr()(*getSnapshot());
                 // return boost::lexical_cast<std::string>(m_val);
             }
             catch (std::exception &e)
             {
                 SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toString exception"
-                                                  << e.what() << " convert: " << typeid(m_val).name() << " to string";
+                                                  << e.what() << " convert: " << typeid(T).name() << " to string";
             }
             return "";
         }
@@ -432,44 +1034,156 @@ namespace sylar
         {
             try
             {
-                setValue(FromStr()(val));
+                return load(FromStr()(val));
                 // m_val = boost::lexical_cast<T>(val);
             }
             catch (std::exception &e)
             {
                 SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << " ConfigVar::fromString "
-                                                  << e.what() << " convert: string to " << typeid(m_val).name();
+                                                  << e.what() << " convert: string to " << typeid(T).name();
             }
             return false;
         }
 
-        const T getValue()
+        /**
+         * 转为YAML结点
+         */
+        YAML::Node toNode() override
         {
-            RWMutexType::ReadLock lock(m_mutex);
-            return m_val;
+            try
+            {
+                return ToNode()(*getSnapshot());
+            }
+            catch (std::exception &e)
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::toNode exception"
+                                                  << e.what() << " convert: " << typeid(T).name() << " to node";
+            }
+            return YAML::Node();
+        }
+
+        /**
+         * 从YAML结点中加载
+         */
+        bool fromNode(const YAML::Node &node) override
+        {
+            try
+            {
+                return load(FromNode()(node));
+            }
+            catch (std::exception &e)
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << " ConfigVar::fromNode "
+                                                  << e.what() << " convert: node to " << typeid(T).name();
+            }
+            return false;
+        }
+
+        bool toBinary(std::string &out) override
+        {
+            if constexpr (SnapshotCodec<T>::SUPPORTED)
+            {
+                SnapshotCodec<T>::Encode(*getSnapshot(), out);
+                return true;
+            }
+            return false;
+        }
+
+        bool fromBinary(const char *data, size_t len) override
+        {
+            if constexpr (SnapshotCodec<T>::SUPPORTED)
+            {
+                T v;
+                const char *end = data + len;
+                if (SnapshotCodec<T>::Decode(data, end, v) && data == end)
+                {
+                    return load(v);
+                }
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar::fromBinary name=" << m_name << " corrupted data";
+            }
+            return false;
+        }
+
+        /**
+         * 获取值的拷贝
+         * 基础数值类型只有一次原子读,其他类型会拷贝整个值,热点路径请使用getSnapshot
+         */
+        const T getValue() const
+        {
+            if constexpr (std::is_arithmetic<T>::value)
+            {
+                return m_scalar.load();
+            }
+            else
+            {
+                return *getSnapshot();
+            }
+        }
+
+        /**
+         * 获取值的只读快照,不加锁也不拷贝值,之后的setValue不会影响已经取得的快照
+         */
+        Snapshot getSnapshot() const
+        {
+            return m_val.load();
         }
 
         /**
          * 设置值的时候，监听值是否发生，如果发生变化，做相应的操作
+         * 监听器在新值发布之后、锁外执行
+         * @return 不满足schema时拒绝修改,返回false,监听器不会执行
          */
-        void setValue(const T &val)
+        bool setValue(const T &val)
         {
+            std::string err;
+            if (!validate(val, err))
+            {
+                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "ConfigVar name=" << m_name << " reject " << err;
+                return false;
+            }
+            Snapshot old_val;
+            Snapshot new_val;
+            std::vector<on_change_cb> cbs;
             {
-                RWMutexType::ReadLock lock(m_mutex);
+                RWMutexType::WriteLock lock(m_mutex);
+                old_val = getSnapshot();
                 // 这里有比较运算，需要在自定义类中重载 ==
-                if (val == m_val)
+                if (val == *old_val)
                 {
-                    return;
+                    return true;
                 }
+                // 发布新的快照,读者不需要加锁
+                new_val = std::make_shared<const T>(val);
+                m_val.store(new_val);
+                if constexpr (std::is_arithmetic<T>::value)
+                {
+                    m_scalar.store(val);
+                }
+                BumpGeneration();
                 for (auto &i : m_cbs)
                 {
-                    // 执行回调函数，回调函数可以有多个，挨个调用
-                    i.second(m_val, val);
+                    cbs.push_back(i.second);
                 }
             }
-            RWMutexType::WriteLock lock(m_mutex);
-            // 赋值
-            m_val = val;
+            if (cbs.empty())
+            {
+                return true;
+            }
+            Scheduler *scheduler = getListenerScheduler();
+            std::weak_ptr<ConfigVarBase> weak = weak_from_this();
+            if (scheduler && !weak.expired())
+            {
+                deferListeners(scheduler, weak, old_val, new_val);
+                return true;
+            }
+            NotifyListeners([cbs, old_val, new_val]()
+                            {
+                for (auto &cb : cbs)
+                {
+                    // 执行回调函数，回调函数可以有多个，挨个调用
+                    cb(*old_val, *new_val);
+                } });
+            return true;
         }
 
         std::string getTypeName() const override
@@ -513,8 +1227,103 @@ namespace sylar
         }
 
     private:
-        RWMutexType m_mutex;
-        T m_val; // 配置的值为value
+        /**
+         * 记录待通知的修改,同一时间最多有一个通知任务在调度器中
+         * 任务执行前的多次修改合并为(最早的旧值, 最新的值)
+         */
+        void deferListeners(Scheduler *scheduler, const std::weak_ptr<ConfigVarBase> &weak,
+                            const Snapshot &old_val, const Snapshot &new_val)
+        {
+            {
+                Mutex::Lock lock(m_pendingMutex);
+                if (!m_pendingOld)
+                {
+                    m_pendingOld = old_val;
+                }
+                m_pendingNew = new_val;
+                if (m_dispatching)
+                {
+                    return;
+                }
+                m_dispatching = true;
+            }
+            ScheduleListeners(scheduler, [weak]()
+                              {
+                ConfigVarBase::ptr self = weak.lock();
+                if (self)
+                {
+                    std::static_pointer_cast<ConfigVar>(self)->runDeferredListeners();
+                } });
+        }
+
+        /**
+         * 在调度器中执行监听器,执行期间的新修改由当前任务继续处理,保证同一配置项的监听器串行
+         */
+        void runDeferredListeners()
+        {
+            while (true)
+            {
+                Snapshot old_val;
+                Snapshot new_val;
+                {
+                    Mutex::Lock lock(m_pendingMutex);
+                    if (!m_pendingNew)
+                    {
+                        m_dispatching = false;
+                        return;
+                    }
+                    old_val.swap(m_pendingOld);
+                    new_val.swap(m_pendingNew);
+                }
+                // 改回了原来的值,不需要通知
+                if (*old_val == *new_val)
+                {
+                    continue;
+                }
+                std::vector<on_change_cb> cbs;
+                {
+                    RWMutexType::ReadLock lock(m_mutex);
+                    for (auto &i : m_cbs)
+                    {
+                        cbs.push_back(i.second);
+                    }
+                }
+                for (auto &cb : cbs)
+                {
+                    cb(*old_val, *new_val);
+                }
+            }
+        }
+
+        /**
+         * 从配置文件加载,不允许重新加载的配置项只有第一次加载生效
+         */
+        bool load(const T &val)
+        {
+            if (!m_schema.isReloadable() && m_loaded && !(val == *getSnapshot()))
+            {
+                SYLAR_LOG_WARN(SYLAR_LOG_ROOT()) << "ConfigVar name=" << m_name
+                                                 << " is not reloadable, restart to apply the new value";
+                return false;
+            }
+            if (!setValue(val))
+            {
+                return false;
+            }
+            m_loaded = true;
+            return true;
+        }
+
+    private:
+        RWMutexType m_mutex;         // 保护监听器,并串行化setValue
+        RcuPtr<const T> m_val;       // 配置的值为value,写时替换整个快照,读取只有一次引用计数的原子加
+        ConfigVarScalar<T> m_scalar; // 基础数值类型的原子副本
+        ConfigSchema m_schema;       // 约束
+        std::atomic<bool> m_loaded{false}; // 是否已经从配置文件加载过
+        Mutex m_pendingMutex;              // 保护待通知的修改
+        Snapshot m_pendingOld;             // 待通知的旧值
+        Snapshot m_pendingNew;             // 待通知的新值
+        bool m_dispatching = false;        // 是否有通知任务在调度器中
         // typedef std::function<void(const T &old_value, const T &new_value)> on_change_cb;
         // 变更回调函数组<key,回调函数> uint64_t key,要求唯一，一般可以用hash值
         std::map<uint64_t, on_change_cb> m_cbs;
@@ -523,7 +1332,7 @@ namespace sylar
     class Config
     {
     public:
-        // 字符串 --> 配置变量
+        // 字符串 --> 配置变量,按名称排序,用于按前缀遍历
         typedef std::map<std::string, ConfigVarBase::ptr> ConfigVarMap;
         // 读写锁
         typedef RWMutex RWMutexType;
@@ -531,45 +1340,46 @@ namespace sylar
         // 静态成员函数
         /**
          * 查找name,如果没有将插入
+         * 已存在时只需要分片的读锁
          */
         template <class T>
         static typename ConfigVar<T>::ptr Lookup(const std::string &name,
                                                  const T &default_value,
-                                                 const std::string &description = "")
+                                                 const std::string &description = "",
+                                                 const ConfigSchema &schema = ConfigSchema())
         {
-            RWMutexType::WriteLock lock(GetMutex());
-            auto it = GetDatas().find(name); // 寻找是否存在key值
-            if (it != GetDatas().end())
+            ConfigVarBase::ptr base = LookupBase(name); // 寻找是否存在key值
+            if (!base)
             {
-                // 查看类型是否相同
-                auto temp = std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
-                auto tmp = Lookup<T>(name); // 调用下面写好的函数
-                if (tmp)
+                // 如果没找到
+                if (name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._1234567890") != std::string::npos)
                 {
-                    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists";
-                    return tmp;
+                    // name中找不到上述字符
+                    SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name invalid" << name;
+                    throw std::invalid_argument(name);
                 }
-                else
+
+                typename ConfigVar<T>::ptr v(new ConfigVar<T>(name, default_value, description, schema));
+                // 放进入,其他线程同时注册了同名配置时返回先注册的
+                base = Register(v);
+                if (base == v)
                 {
-                    SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists but type not"
-                                                      << typeid(T).name()
-                                                      << " real type" << it->second->getTypeName()
-                                                      << " " << it->second->toString();
-                    return nullptr;
+                    return v;
                 }
             }
 
-            // 如果没找到
-            if (name.find_first_not_of("abcdefghijklmnopqrstuvwxyz._1234567890") != std::string::npos)
+            // 查看类型是否相同
+            auto tmp = Cast<T>(base);
+            if (tmp)
             {
-                // name中找不到上述字符
-                SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name invalid" << name;
-                throw std::invalid_argument(name);
+                SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists";
+                return tmp;
             }
-
-            typename ConfigVar<T>::ptr v(new ConfigVar<T>(name, default_value, description));
-            GetDatas()[name] = v; // 放进入
-            return v;
+            SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "Lookup name=" << name << " exists but type not"
+                                              << typeid(T).name()
+                                              << " real type" << base->getTypeName()
+                                              << " " << base->toString();
+            return nullptr;
         }
 
         /**
@@ -578,40 +1388,113 @@ namespace sylar
         template <class T>
         static typename ConfigVar<T>::ptr Lookup(const std::string &name)
         {
-            RWMutexType::ReadLock lock(GetMutex());
-            auto it = GetDatas().find(name);
-            if (it == GetDatas().end())
+            // 转为智能指针
+            return Cast<T>(LookupBase(name));
+        }
+
+        /**
+         * 类型相同时转为ConfigVar<T>,否则返回nullptr
+         * 比较类型标识,不需要dynamic_pointer_cast
+         */
+        template <class T>
+        static typename ConfigVar<T>::ptr Cast(const ConfigVarBase::ptr &base)
+        {
+            if (base && base->getTypeId() == ConfigTypeId<ConfigVar<T>>())
             {
-                return nullptr;
+                return std::static_pointer_cast<ConfigVar<T>>(base);
             }
-            // 转为智能指针  it->second访问值,it->first访问键
-            return std::dynamic_pointer_cast<ConfigVar<T>>(it->second);
+            return nullptr;
         }
+
         /**
          * 从yaml中加载配置
+         * 所有配置项设置完成后才统一执行监听器
          */
         static void LoadFromYaml(const YAML::Node &root);
 
+        /**
+         * @brief 加载目录下的所有yaml文件(.yml/.yaml)
+         * 只解析修改时间变化的文件,只更新文件中内容发生变化的配置项,监听器在最后统一执行
+         * @param path 配置目录
+         * @param force 为true时忽略缓存,全部重新加载
+         */
+        static void LoadFromConfDir(const std::string &path, bool force = false);
+
+        /**
+         * @brief 把所有配置项的当前值保存为二进制快照文件
+         * 支持二进制编码的类型直接保存编码后的值,其他类型保存toString()的结果
+         * @param source_hash 生成快照的配置文件列表的hash,记录在文件头中
+         * @return 写入成功返回true
+         */
+        static bool SaveSnapshot(const std::string &path, uint64_t source_hash = 0);
+
+        /**
+         * @brief mmap加载二进制快照
+         * 快照中的配置项名称和类型与当前注册的不一致(schema hash不同)或文件损坏时不加载任何配置项
+         * @param source_hash 不为0时要求与快照文件头中记录的一致
+         * @return 加载成功返回true,失败时应该回退到yaml
+         */
+        static bool LoadSnapshot(const std::string &path, uint64_t source_hash = 0);
+
+        /**
+         * @brief 启动时加载配置,配置目录的文件列表(路径、大小、修改时间)与生成快照时一致时直接加载快照
+         * 否则加载配置目录,并重新生成快照
+         * @param path 配置目录
+         * @param snapshot 快照文件
+         */
+        static void LoadWithSnapshot(const std::string &path, const std::string &snapshot);
+
+        /**
+         * 所有已注册配置项的名称和类型的hash,用于判断快照是否可用
+         */
+        static uint64_t GetSchemaHash();
+
+        /**
+         * 全局配置版本号,setValue和LoadFromYaml后改变
+         */
+        static uint64_t GetGeneration()
+        {
+            return ConfigVarBase::GetGeneration();
+        }
+
         /**
          * 根据name查找对应的ConfigVarBase
          */
         static ConfigVarBase::ptr LookupBase(const std::string &name);
 
         /**
-         * @brief 遍历配置模块里面所有配置项
-         * @param[in] cb 配置项回调函数
+         * @brief 遍历配置模块里面所有配置项,按名称排序
+         * @param[in] cb 配置项回调函数,不持有锁,可以在其中注册配置项
          */
         static void Visit(std::function<void(ConfigVarBase::ptr)> cb);
 
+        /**
+         * @brief 遍历名称为prefix或以"prefix."开头的配置项,如"logs"或"logs.*"
+         * @param[in] prefix 前缀,为空时遍历所有配置项
+         * @param[in] cb 配置项回调函数
+         */
+        static void Visit(const std::string &prefix, std::function<void(ConfigVarBase::ptr)> cb);
+
     private:
         /**
-         * 配置项的所有配置项
+         * 注册配置项,已存在同名配置项时返回已存在的
+         */
+        static ConfigVarBase::ptr Register(ConfigVarBase::ptr var);
+
+        // 分片数量,按名称hash分散注册和查找的锁竞争
+        static const size_t SHARD_COUNT = 16;
+
+        /**
+         * 配置项的一个分片
+         * 查找表和有序索引在同一把锁下插入,配置项对Lookup和Visit同时可见
          */
-        static ConfigVarMap &GetDatas()
+        struct Shard
         {
-            static ConfigVarMap s_datas;
-            return s_datas;
-        }
+            RWMutexType mutex;
+            std::unordered_map<std::string, ConfigVarBase::ptr> datas; // 按名称查找
+            ConfigVarMap index;                                         // 有序索引,只在注册和遍历时使用
+        };
+
         /**
          * 放在静态方法里，静态锁
          * 为什么使用静态方法的形式返回读写锁？
@@ -619,17 +1502,59 @@ namespace sylar
          * 如果不使用静态方法，而使用静态成员的方式，如果静态成员的初始化顺序，比执行那个方法要晚
          * 就会出现，锁还没有构建成功，会出现内存错误
          */
+        static Shard *GetShards()
+        {
+            static Shard s_shards[SHARD_COUNT];
+            return s_shards;
+        }
 
         /**
-         * 配置项的所有RWMutex
+         * 名称所在的分片
          */
-        static RWMutexType &GetMutex()
+        static Shard &GetShard(const std::string &name)
         {
-            static RWMutexType s_mutex;
-            return s_mutex;
+            return GetShards()[std::hash<std::string>()(name) % SHARD_COUNT];
         }
     };
 
+    /**
+     * 配置项的缓存,一般定义为static thread_local
+     * 全局版本号不变时直接返回缓存的快照,只需要一次比较
+     * static thread_local sylar::ConfigCache<int> s_port(g_port);
+     * int port = s_port.get();
+     */
+    template <class T>
+    class ConfigCache
+    {
+    public:
+        ConfigCache(typename ConfigVar<T>::ptr var)
+            : m_var(var)
+        {
+        }
+
+        /**
+         * 获取配置的值,引用在下一次get之前有效
+         */
+        const T &get()
+        {
+            uint64_t generation = Config::GetGeneration();
+            if (generation != m_generation)
+            {
+                // 先记录版本号再取快照,取快照期间的修改会在下一次get时更新
+                m_generation = generation;
+                m_value = m_var->getSnapshot();
+            }
+            return *m_value;
+        }
+
+        const T &operator*() { return get(); }
+        const T *operator->() { return &get(); }
+
+    private:
+        typename ConfigVar<T>::ptr m_var;        // 配置项
+        typename ConfigVar<T>::Snapshot m_value; // 缓存的快照
+        uint64_t m_generation = 0;               // 缓存时的版本号
+    };
 }
 
 #endif
\ No newline at end of file
@@ -0,0 +1,126 @@
+#include "config_watcher.h"
+#include "config.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+
+namespace sylar
+{
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    static bool IsYamlFile(const char *name)
+    {
+        std::string str = name;
+        size_t pos = str.rfind('.');
+        if (pos == std::string::npos)
+        {
+            return false;
+        }
+        std::string ext = str.substr(pos);
+        return ext == ".yml" || ext == ".yaml";
+    }
+
+    ConfigWatcher::ConfigWatcher(const std::string &dir, IOManager *iom)
+        : m_dir(dir),
+          m_iom(iom)
+    {
+    }
+
+    ConfigWatcher::~ConfigWatcher()
+    {
+        if (m_fd >= 0)
+        {
+            // 回调中持有的是weak_ptr,触发后不会再访问this
+            m_iom->cancelAll(m_fd);
+            close(m_fd);
+        }
+    }
+
+    bool ConfigWatcher::start()
+    {
+        Config::LoadFromConfDir(m_dir);
+
+        m_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_fd < 0)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "inotify_init1 failed errno=" << errno << " " << strerror(errno);
+            return false;
+        }
+        // 编辑器保存一般是写入后关闭,或者写临时文件再重命名
+        if (inotify_add_watch(m_fd, m_dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "inotify_add_watch " << m_dir << " failed errno=" << errno
+                                      << " " << strerror(errno);
+            close(m_fd);
+            m_fd = -1;
+            return false;
+        }
+        // 注册事件必须在IOManager的线程中进行
+        std::weak_ptr<ConfigWatcher> weak_self = shared_from_this();
+        m_iom->schedule([weak_self]()
+                        {
+            auto self = weak_self.lock();
+            if (self)
+            {
+                self->watch();
+            } });
+        return true;
+    }
+
+    void ConfigWatcher::stop()
+    {
+        if (!m_stopped.exchange(true) && m_fd >= 0)
+        {
+            // 触发回调,回调中看到m_stopped后不再注册
+            m_iom->cancelAll(m_fd);
+        }
+    }
+
+    void ConfigWatcher::watch()
+    {
+        if (m_stopped)
+        {
+            return;
+        }
+        std::weak_ptr<ConfigWatcher> weak_self = shared_from_this();
+        m_iom->addEvent(m_fd, IOManager::READ, [weak_self]()
+                        {
+            auto self = weak_self.lock();
+            if (self)
+            {
+                self->onEvent();
+            } });
+    }
+
+    void ConfigWatcher::onEvent()
+    {
+        if (m_stopped)
+        {
+            return;
+        }
+        // 一次保存可能产生多个事件,全部读完后只加载一次
+        bool changed = false;
+        char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+        while (true)
+        {
+            ssize_t n = read(m_fd, buf, sizeof(buf));
+            if (n <= 0)
+            {
+                break;
+            }
+            for (char *p = buf; p < buf + n;)
+            {
+                struct inotify_event *ev = (struct inotify_event *)p;
+                if (ev->len > 0 && IsYamlFile(ev->name))
+                {
+                    changed = true;
+                }
+                p += sizeof(struct inotify_event) + ev->len;
+            }
+        }
+        if (changed)
+        {
+            Config::LoadFromConfDir(m_dir);
+        }
+        watch();
+    }
+}
@@ -0,0 +1,61 @@
+#ifndef __SYLAR_CONFIG_WATCHER_H__
+#define __SYLAR_CONFIG_WATCHER_H__
+
+#include <memory>
+#include <string>
+#include <atomic>
+#include "iomanager.h"
+
+namespace sylar
+{
+    /**
+     * 配置目录监听
+     * 使用inotify监听目录中yaml文件的写入和移动,由IOManager等待事件
+     * 文件变化后调用Config::LoadFromConfDir,只重新加载变化的文件和配置项
+     */
+    class ConfigWatcher : public std::enable_shared_from_this<ConfigWatcher>
+    {
+    public:
+        typedef std::shared_ptr<ConfigWatcher> ptr;
+
+        /**
+         * @param dir 配置目录
+         * @param iom 等待inotify事件的IO调度器
+         */
+        ConfigWatcher(const std::string &dir, IOManager *iom);
+
+        ~ConfigWatcher();
+
+        /**
+         * @brief 先加载一次目录,再开始监听
+         * @return inotify初始化成功返回true
+         */
+        bool start();
+
+        /**
+         * 停止监听
+         */
+        void stop();
+
+        const std::string &getDir() const { return m_dir; }
+
+    private:
+        /**
+         * 在IOManager上注册读事件
+         */
+        void watch();
+
+        /**
+         * 读取所有inotify事件,有yaml文件变化时重新加载
+         */
+        void onEvent();
+
+    private:
+        std::string m_dir;                  // 配置目录
+        IOManager *m_iom;                   // IO调度器
+        int m_fd = -1;                      // inotify句柄
+        std::atomic<bool> m_stopped{false}; // 是否已经停止
+    };
+}
+
+#endif
@@ -63,12 +63,12 @@ namespace sylar
         SYLAR_LOG_DEBUG(g_logger) << "Fiber::Fiber() create main fiber";
     }
 
-    Fiber::Fiber(std::function<void()> cb, size_t stacksize, bool use_caller)
+    Fiber::Fiber(Task cb, size_t stacksize, bool use_caller)
         : m_id(++s_fiber_id),
-          m_cb(cb)
+          m_cb(std::move(cb))
     {
         ++s_fiber_count;
-        // 设置栈大小
+        // 设置栈大小,数值类型配置的getValue只是一次原子读
         m_stacksize = stacksize ? stacksize : g_fiber_stack_size->getValue();
         // 申请栈内存
         m_stack = StackAllocator::Alloc(m_stacksize);
@@ -126,7 +126,7 @@ namespace sylar
                                   << " total=" << s_fiber_count;
     }
 
-    void Fiber::reset(std::function<void()> cb)
+    void Fiber::reset(Task cb)
     {
         // 为了充分利用内存，一个协程执行完了，但分配的内存可以重复使用
         SYLAR_ASSERT(m_stack);
@@ -134,7 +134,7 @@ namespace sylar
                      m_state == EXCEPT ||
                      m_state == INIT);
 
-        m_cb = cb;
+        m_cb = std::move(cb);
 
         if (getcontext(&m_ctx))
         {
@@ -159,14 +159,14 @@ namespace sylar
         if (t_fiber)
         {
             // 如果当前运行协程不为空，则直接返回
-            return t_fiber->shared_from_this();
+            return Fiber::ptr(t_fiber);
         }
         // 如果没有就创建一个主协程,使用智能指针管理
         Fiber::ptr main_fiber(new Fiber); // 调用无参构造函数，内部将创建好的协程赋给t_fiber
         SYLAR_ASSERT(t_fiber == main_fiber.get());
         // 赋值给主协程
         t_threadFiber = main_fiber;
-        return t_fiber->shared_from_this();
+        return main_fiber;
     }
 
     // 切换到当前协程执行
@@ -215,9 +215,9 @@ namespace sylar
 
     void Fiber::YieldToReady()
     {
-        // 获得当前协程
-        Fiber::ptr cur = GetThis();
-        SYLAR_ASSERT(cur->m_state == EXEC);
+        // 获得当前协程,执行期间调度器持有它的引用,这里用裸指针,让出不修改引用计数
+        Fiber *cur = t_fiber;
+        SYLAR_ASSERT(cur && cur->m_state == EXEC);
         cur->m_state = READY;
         cur->swapOut();
     }
@@ -236,6 +236,11 @@ namespace sylar
         return s_fiber_count;
     }
 
+    uint32_t Fiber::GetDefaultStackSize()
+    {
+        return g_fiber_stack_size->getValue();
+    }
+
     void Fiber::MainFunc()
     {
         // 获得当前执行的协程
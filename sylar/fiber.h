@@ -2,9 +2,12 @@
 #define __SYLAR_FIBER_H__
 
 #include <memory>
+#include <atomic>
 #include <functional>
 #include <ucontext.h>
 #include "thread.h"
+#include "task.h"
+#include "intrusive_ptr.h"
 
 namespace sylar
 {
@@ -14,12 +17,13 @@ namespace sylar
      * @brief 协程类
      *
      */
-    class Fiber : public std::enable_shared_from_this<Fiber>
+    class Fiber
     {
         friend class Scheduler;
 
     public:
-        typedef std::shared_ptr<Fiber> ptr;
+        // 侵入式引用计数,调度队列直接链接协程,入队出队不修改引用计数
+        typedef IntrusivePtr<Fiber> ptr;
 
         enum State
         {
@@ -45,7 +49,7 @@ namespace sylar
          * @param stacksize 协程栈大小
          * @param use_caller 是否在MainFiber上调度
          */
-        Fiber(std::function<void()> cb, size_t stacksize = 0, bool use_caller = false);
+        Fiber(Task cb, size_t stacksize = 0, bool use_caller = false);
 
         /**
          * @brief Destroy the Fiber object
@@ -57,7 +61,7 @@ namespace sylar
          * 重置协程，重新分配一个函数，状态重置
          * 为了内存复用
          */
-        void reset(std::function<void()> cb);
+        void reset(Task cb);
 
         /**
          * 把正在运行的协程放到后台，运行该协程
@@ -99,11 +103,29 @@ namespace sylar
          */
         State getState() const { return m_state; }
 
+        /**
+         * @brief 返回协程栈大小,主协程为0
+         */
+        uint32_t getStackSize() const { return m_stacksize; }
+
         void setState(const State state)
         {
             m_state = state;
         }
 
+        /**
+         * @brief 引用计数,由Fiber::ptr调用
+         */
+        void incRef() { m_refs.fetch_add(1, std::memory_order_relaxed); }
+        void decRef()
+        {
+            if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+            {
+                delete this;
+            }
+        }
+        int32_t getRefCount() const { return m_refs.load(std::memory_order_relaxed); }
+
     public:
         /**
          * @brief 设置当前协程为f
@@ -119,6 +141,7 @@ namespace sylar
         /**
          * 将当前正在执行的协程
          * 切换到后台并且设置为Ready状态
+         * 不修改引用计数,执行期间由调度器(或调用方)持有协程的引用
          */
         static void YieldToReady();
 
@@ -133,6 +156,11 @@ namespace sylar
          */
         static uint64_t TotalFibers();
 
+        /**
+         * 默认的协程栈大小,配置fiber.stack_size
+         */
+        static uint32_t GetDefaultStackSize();
+
         /**
          * 协程所要执行的主函数
          * 执行完后返回到线程的主协程
@@ -158,7 +186,17 @@ namespace sylar
         ucontext_t m_ctx; // 保存上下文
 
         void *m_stack = nullptr;    // 协程栈
-        std::function<void()> m_cb; // 协程执行的函数
+        Task m_cb;                  // 协程执行的函数
+        std::atomic<int32_t> m_refs = {0}; // 引用计数
+
+        // 调度队列的侵入式钩子,在调度器队列中时由调度器持有锁访问,队列持有一个引用
+        Fiber *m_queueNext = nullptr; // 队列中的下一个协程
+        uint64_t m_queueSeq = 0;      // 入队序号,与函数任务一起保持先进先出
+        uint64_t m_enqueueMs = 0;     // 入队时间
+        int m_queueThread = -1;       // 指定执行的线程id,-1表示任意线程
+        int m_queuePriority = 0;      // 所在的优先级队列
+        bool m_queued = false;        // 是否在调度队列中,同一时间只能在一个调度器的一个队列中
+        uint64_t m_deadlineMs = 0;    // 正在执行的截止时间任务的截止时间,让出后重新调度时仍放入截止时间堆
     };
 
 }
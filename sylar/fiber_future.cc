@@ -0,0 +1,165 @@
+#include "fiber_future.h"
+#include "scheduler.h"
+#include "macro.h"
+
+namespace sylar
+{
+    void WaitQueue::wait(MutexType::Lock &lock)
+    {
+        Scheduler *scheduler = Scheduler::GetThis();
+        Fiber::ptr cur = Fiber::GetThis();
+        if (scheduler && cur.get() != Scheduler::GetMainFiber() && cur->getStackSize())
+        {
+            // 在调度器的协程中:记下协程,唤醒时重新加入调度器
+            // 唤醒可能发生在让出之前,调度器会跳过仍在EXEC状态的协程,让出后再执行,不会丢失
+            m_waiters.emplace_back([scheduler, cur]() mutable
+                                   { scheduler->schedule(std::move(cur)); });
+            lock.unlock();
+            Fiber::YieldToHold();
+        }
+        else
+        {
+            // 普通线程:阻塞在信号量上
+            Semaphore sem;
+            m_waiters.emplace_back([&sem]()
+                                   { sem.notify(); });
+            lock.unlock();
+            sem.wait();
+        }
+    }
+
+    void WaitQueue::addCallback(Task cb)
+    {
+        m_waiters.push_back(std::move(cb));
+    }
+
+    void WaitQueue::notifyAll(MutexType::Lock &lock)
+    {
+        std::vector<Task> waiters;
+        waiters.swap(m_waiters);
+        lock.unlock();
+        for (auto &i : waiters)
+        {
+            i();
+        }
+    }
+
+    bool FutureStateBase::isReady()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_ready;
+    }
+
+    void FutureStateBase::wait()
+    {
+        MutexType::Lock lock(m_mutex);
+        while (!m_ready)
+        {
+            m_waiters.wait(lock);
+            lock.lock();
+        }
+    }
+
+    void FutureStateBase::then(Task cb)
+    {
+        MutexType::Lock lock(m_mutex);
+        if (!m_ready)
+        {
+            m_waiters.addCallback(std::move(cb));
+            return;
+        }
+        lock.unlock();
+        cb();
+    }
+
+    void FutureStateBase::setException(std::exception_ptr error)
+    {
+        MutexType::Lock lock(m_mutex);
+        m_error = error;
+        finish(lock);
+    }
+
+    void FutureStateBase::rethrow()
+    {
+        MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT(m_ready);
+        if (m_error)
+        {
+            std::exception_ptr error = m_error;
+            lock.unlock();
+            std::rethrow_exception(error);
+        }
+    }
+
+    void FutureStateBase::finish(MutexType::Lock &lock)
+    {
+        SYLAR_ASSERT(!m_ready);
+        m_ready = true;
+        m_waiters.notifyAll(lock);
+    }
+
+    void WaitGroup::add(int n)
+    {
+        MutexType::Lock lock(m_mutex);
+        m_count += n;
+        SYLAR_ASSERT(m_count >= 0);
+    }
+
+    void WaitGroup::done()
+    {
+        MutexType::Lock lock(m_mutex);
+        SYLAR_ASSERT(m_count > 0);
+        if (--m_count == 0)
+        {
+            m_waiters.notifyAll(lock);
+        }
+    }
+
+    void WaitGroup::wait()
+    {
+        MutexType::Lock lock(m_mutex);
+        while (m_count > 0)
+        {
+            m_waiters.wait(lock);
+            lock.lock();
+        }
+    }
+
+    /**
+     * @brief WaitAny的共享状态,每个任务结束时的回调都持有它
+     */
+    struct AnyState
+    {
+        Mutex mutex;
+        int index = -1; // 第一个结束的任务下标
+        WaitQueue waiters;
+    };
+
+    int WaitAny(const std::vector<FutureStateBase::ptr> &states)
+    {
+        if (states.empty())
+        {
+            return -1;
+        }
+        std::shared_ptr<AnyState> any(new AnyState);
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            states[i]->then([any, i]()
+                            {
+                                Mutex::Lock lock(any->mutex);
+                                if (any->index == -1)
+                                {
+                                    any->index = i;
+                                    any->waiters.notifyAll(lock);
+                                } });
+        }
+        Mutex::Lock lock(any->mutex);
+        while (any->index == -1)
+        {
+            any->waiters.wait(lock);
+            lock.lock();
+        }
+        return any->index;
+    }
+
+}
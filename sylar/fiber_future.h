@@ -0,0 +1,264 @@
+#ifndef __SYLAR_FIBER_FUTURE_H__
+#define __SYLAR_FIBER_FUTURE_H__
+
+#include <memory>
+#include <vector>
+#include <exception>
+#include <type_traits>
+#include "mutex.h"
+#include "fiber.h"
+#include "task.h"
+
+namespace sylar
+{
+    /**
+     * @brief 协程等待队列
+     * 在协程调度器的协程中等待时挂起当前协程(线程继续执行其他任务),被唤醒时协程重新加入原调度器;
+     * 不在协程调度器中(普通线程)时阻塞当前线程
+     */
+    class WaitQueue : Noncopyable
+    {
+    public:
+        typedef Mutex MutexType;
+
+        /**
+         * @brief 等待notifyAll
+         * @param lock 保护等待条件的锁,需已加锁,挂起前释放,返回时未加锁
+         */
+        void wait(MutexType::Lock &lock);
+
+        /**
+         * @brief 加入回调,notifyAll时执行,需持有保护等待条件的锁
+         */
+        void addCallback(Task cb);
+
+        /**
+         * @brief 唤醒所有等待者并执行回调
+         * @param lock 保护等待条件的锁,需已加锁,在锁外唤醒,返回时未加锁
+         */
+        void notifyAll(MutexType::Lock &lock);
+
+    private:
+        std::vector<Task> m_waiters; // 唤醒等待者的回调
+    };
+
+    /**
+     * @brief FiberFuture的共享状态,与值类型无关的部分
+     */
+    class FutureStateBase : Noncopyable
+    {
+    public:
+        typedef std::shared_ptr<FutureStateBase> ptr;
+        typedef Mutex MutexType;
+
+        virtual ~FutureStateBase() {}
+
+        /**
+         * @brief 是否已完成(有值或异常)
+         */
+        bool isReady();
+
+        /**
+         * @brief 等待完成,挂起当前协程
+         */
+        void wait();
+
+        /**
+         * @brief 完成后执行cb,已完成则立即在当前协程执行
+         */
+        void then(Task cb);
+
+        /**
+         * @brief 以异常结束
+         */
+        void setException(std::exception_ptr error);
+
+        /**
+         * @brief 有异常时抛出,需要已完成
+         */
+        void rethrow();
+
+    protected:
+        /**
+         * @brief 标记为已完成并唤醒等待者,需持有lock,返回时未加锁
+         */
+        void finish(MutexType::Lock &lock);
+
+    protected:
+        MutexType m_mutex;
+        bool m_ready = false;        // 是否已完成
+        std::exception_ptr m_error;  // 任务抛出的异常
+        WaitQueue m_waiters;         // 等待完成的协程和回调
+    };
+
+    /**
+     * @brief FiberFuture的共享状态
+     */
+    template <class T>
+    class FutureState : public FutureStateBase
+    {
+    public:
+        typedef std::shared_ptr<FutureState> ptr;
+
+        void setValue(T v)
+        {
+            MutexType::Lock lock(m_mutex);
+            m_value.reset(new T(std::move(v)));
+            finish(lock);
+        }
+
+        T &value() { return *m_value; }
+
+    private:
+        std::unique_ptr<T> m_value;
+    };
+
+    template <>
+    class FutureState<void> : public FutureStateBase
+    {
+    public:
+        typedef std::shared_ptr<FutureState> ptr;
+
+        void setValue()
+        {
+            MutexType::Lock lock(m_mutex);
+            finish(lock);
+        }
+    };
+
+    /**
+     * @brief 协程任务的结果
+     * 由Scheduler::scheduleFuture返回,get()挂起当前协程直到任务结束,
+     * 任务抛出异常时get()重新抛出该异常
+     */
+    template <class T>
+    class FiberFuture
+    {
+    public:
+        FiberFuture() {}
+        explicit FiberFuture(typename FutureState<T>::ptr state)
+            : m_state(std::move(state))
+        {
+        }
+
+        bool valid() const { return m_state != nullptr; }
+        bool isReady() const { return m_state->isReady(); }
+
+        /**
+         * @brief 等待任务结束,不抛出任务的异常
+         */
+        void wait() const { m_state->wait(); }
+
+        /**
+         * @brief 等待任务结束并取走结果,任务异常结束时抛出其异常,只能调用一次
+         */
+        T get()
+        {
+            m_state->wait();
+            m_state->rethrow();
+            if constexpr (!std::is_void<T>::value)
+            {
+                return std::move(m_state->value());
+            }
+        }
+
+        /**
+         * @brief 任务结束后执行cb
+         */
+        void then(Task cb) { m_state->then(std::move(cb)); }
+
+        FutureStateBase::ptr getState() const { return m_state; }
+
+    private:
+        typename FutureState<T>::ptr m_state;
+    };
+
+    /**
+     * @brief 在协程中执行f并把结果写入state
+     * 异常只写入state,由get()交给等待者处理,不再抛出到协程入口(协程正常结束,不输出错误日志)
+     */
+    template <class T, class F>
+    void RunFuture(FutureState<T> &state, F &f)
+    {
+        try
+        {
+            if constexpr (std::is_void<T>::value)
+            {
+                f();
+                state.setValue();
+            }
+            else
+            {
+                state.setValue(f());
+            }
+        }
+        catch (...)
+        {
+            state.setException(std::current_exception());
+        }
+    }
+
+    /**
+     * @brief 等待计数归零,计数归零前挂起等待的协程
+     */
+    class WaitGroup : Noncopyable
+    {
+    public:
+        typedef Mutex MutexType;
+
+        /**
+         * @brief 计数加n
+         */
+        void add(int n = 1);
+
+        /**
+         * @brief 计数减1,归零时唤醒所有等待者
+         */
+        void done();
+
+        /**
+         * @brief 等待计数归零
+         */
+        void wait();
+
+    private:
+        MutexType m_mutex;
+        int64_t m_count = 0;
+        WaitQueue m_waiters;
+    };
+
+    /**
+     * @brief 等待任意一个完成,返回第一个完成的下标,states为空返回-1
+     */
+    int WaitAny(const std::vector<FutureStateBase::ptr> &states);
+
+    /**
+     * @brief 等待所有任务结束,不抛出异常,之后用get()取结果
+     */
+    template <class T>
+    void WhenAll(std::vector<FiberFuture<T>> &futures)
+    {
+        for (auto &i : futures)
+        {
+            i.wait();
+        }
+    }
+
+    /**
+     * @brief 等待任意一个任务结束,返回它的下标
+     */
+    template <class T>
+    int WhenAny(std::vector<FiberFuture<T>> &futures)
+    {
+        std::vector<FutureStateBase::ptr> states;
+        states.reserve(futures.size());
+        for (auto &i : futures)
+        {
+            states.push_back(i.getState());
+        }
+        return WaitAny(states);
+    }
+
+}
+
+#endif
@@ -0,0 +1,115 @@
+#ifndef __SYLAR_INTRUSIVE_PTR_H__
+#define __SYLAR_INTRUSIVE_PTR_H__
+
+#include <cstddef>
+#include <utility>
+
+namespace sylar
+{
+    /**
+     * @brief 侵入式智能指针
+     * 引用计数保存在对象内部(T需要提供incRef()、decRef()、getRefCount()),
+     * 没有单独的控制块;移动、detach()、adopt构造都不修改引用计数,
+     * 对象可以在裸指针(如侵入式队列)和智能指针之间转移所有权而不做原子操作
+     */
+    template <class T>
+    class IntrusivePtr
+    {
+    public:
+        IntrusivePtr() noexcept {}
+        IntrusivePtr(std::nullptr_t) noexcept {}
+
+        /**
+         * @brief 从裸指针构造
+         * @param p 对象指针
+         * @param add_ref 是否增加引用计数,false表示接管p已持有的一个引用
+         */
+        explicit IntrusivePtr(T *p, bool add_ref = true)
+            : m_ptr(p)
+        {
+            if (m_ptr && add_ref)
+            {
+                m_ptr->incRef();
+            }
+        }
+
+        IntrusivePtr(const IntrusivePtr &other)
+            : m_ptr(other.m_ptr)
+        {
+            if (m_ptr)
+            {
+                m_ptr->incRef();
+            }
+        }
+
+        IntrusivePtr(IntrusivePtr &&other) noexcept
+            : m_ptr(other.m_ptr)
+        {
+            other.m_ptr = nullptr;
+        }
+
+        ~IntrusivePtr()
+        {
+            if (m_ptr)
+            {
+                m_ptr->decRef();
+            }
+        }
+
+        IntrusivePtr &operator=(const IntrusivePtr &other)
+        {
+            IntrusivePtr(other).swap(*this);
+            return *this;
+        }
+
+        IntrusivePtr &operator=(IntrusivePtr &&other) noexcept
+        {
+            IntrusivePtr(std::move(other)).swap(*this);
+            return *this;
+        }
+
+        IntrusivePtr &operator=(std::nullptr_t)
+        {
+            reset();
+            return *this;
+        }
+
+        void reset(T *p = nullptr)
+        {
+            IntrusivePtr(p).swap(*this);
+        }
+
+        void swap(IntrusivePtr &other) noexcept
+        {
+            std::swap(m_ptr, other.m_ptr);
+        }
+
+        /**
+         * @brief 放弃所有权但不减少引用计数,返回裸指针,由调用者负责之后释放
+         */
+        T *detach() noexcept
+        {
+            T *p = m_ptr;
+            m_ptr = nullptr;
+            return p;
+        }
+
+        T *get() const noexcept { return m_ptr; }
+        T *operator->() const noexcept { return m_ptr; }
+        T &operator*() const noexcept { return *m_ptr; }
+        explicit operator bool() const noexcept { return m_ptr != nullptr; }
+
+        long use_count() const { return m_ptr ? m_ptr->getRefCount() : 0; }
+
+        bool operator==(const IntrusivePtr &other) const { return m_ptr == other.m_ptr; }
+        bool operator!=(const IntrusivePtr &other) const { return m_ptr != other.m_ptr; }
+        bool operator==(std::nullptr_t) const { return m_ptr == nullptr; }
+        bool operator!=(std::nullptr_t) const { return m_ptr != nullptr; }
+
+    private:
+        T *m_ptr = nullptr;
+    };
+
+}
+
+#endif
@@ -5,6 +5,7 @@
 #include <unistd.h>
 #include <sys/epoll.h>
 #include <fcntl.h>
+#include <algorithm>
 
 namespace sylar
 {
@@ -398,6 +399,17 @@ namespace sylar
         SYLAR_ASSERT(rt == 1);
     }
 
+    void IOManager::tickleIdle(size_t count)
+    {
+        // 每写入一次,epoll唤醒一个在epoll_wait中等待的线程,最多唤醒空闲线程数量个
+        size_t n = std::min<size_t>(count, m_idleThreadCount);
+        for (size_t i = 0; i < n; ++i)
+        {
+            int rt = write(m_tickleFds[1], "T", 1);
+            SYLAR_ASSERT(rt == 1);
+        }
+    }
+
     bool IOManager::stopping(uint64_t &timeout)
     {
         // timeout = getNextTimer();
@@ -453,6 +465,12 @@ namespace sylar
                 {
                     next_timeout = MAX_TIMEOUT;
                 }
+                // 有RCU对象等待释放时定时醒来,回到调度循环的静止点推进epoch
+                static const uint64_t RCU_POLL_TIMEOUT = 10;
+                if (Rcu::GetPending() && next_timeout > RCU_POLL_TIMEOUT)
+                {
+                    next_timeout = RCU_POLL_TIMEOUT;
+                }
                 // 获取事件是否有触发的
                 /**
                  * next_timeout
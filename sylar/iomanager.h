@@ -25,7 +25,8 @@ namespace sylar
     {
     public:
         typedef std::shared_ptr<IOManager> ptr;
-        typedef RWMutex RWMutexType;
+        // 每次addEvent/delEvent/cancelEvent都加读锁,只有扩容时加写锁
+        typedef BrRWMutex RWMutexType;
 
         /**
          * @brief IO事件
@@ -145,6 +146,7 @@ namespace sylar
     protected:
         // 父类的方法
         void tickle() override;
+        void tickleIdle(size_t count) override;
         bool stopping() override;
         void idle() override;
         // void onTimerInsertedAtFront() override;
@@ -7,6 +7,7 @@
 #include <time.h>
 #include <string.h>
 #include <stdarg.h>
+#include <algorithm>
 
 namespace sylar
 {
@@ -93,6 +94,249 @@ namespace sylar
         }
     }
 
+    const std::string &LogEvent::getContent() const
+    {
+        if (!m_rendered)
+        {
+            if (m_fmt)
+            {
+                // 格式化方式写入的日志，此时才生成文本
+                m_content = LogArgs::Render(m_fmt, m_args) + m_ss.str();
+            }
+            else
+            {
+                m_content = m_ss.str();
+            }
+            m_rendered = true;
+        }
+        return m_content;
+    }
+
+    void LogArgs::EncodeOne(std::string &out, const char *v)
+    {
+        if (!v)
+        {
+            v = "(null)";
+        }
+        uint32_t len = strlen(v);
+        out.push_back((char)STRING);
+        out.append((const char *)&len, sizeof(len));
+        out.append(v, len);
+    }
+
+    void LogArgs::EncodeOne(std::string &out, const std::string &v)
+    {
+        uint32_t len = v.size();
+        out.push_back((char)STRING);
+        out.append((const char *)&len, sizeof(len));
+        out.append(v);
+    }
+
+    /**
+     * 解码出的单个参数
+     */
+    struct LogArgValue
+    {
+        int type = 0;
+        int64_t i = 0;
+        uint64_t u = 0;
+        double d = 0;
+        std::string s;
+    };
+
+    // 从p开始解码一个参数，数据不完整返回false
+    static bool DecodeLogArg(const char *&p, const char *end, LogArgValue &v)
+    {
+        if (p >= end)
+        {
+            return false;
+        }
+        v.type = (uint8_t)*p++;
+        switch (v.type)
+        {
+#define XX(type, T)                \
+    case LogArgs::type:            \
+    {                              \
+        T t;                       \
+        if (end - p < (long)sizeof(t)) \
+        {                          \
+            return false;          \
+        }                          \
+        memcpy(&t, p, sizeof(t));  \
+        p += sizeof(t);            \
+        v.i = (int64_t)t;          \
+        v.u = (uint64_t)t;         \
+        v.d = (double)t;           \
+        return true;               \
+    }
+            XX(INT32, int32_t);
+            XX(INT64, int64_t);
+            XX(UINT32, uint32_t);
+            XX(UINT64, uint64_t);
+            XX(POINTER, uint64_t);
+#undef XX
+        case LogArgs::DOUBLE:
+        {
+            if (end - p < (long)sizeof(double))
+            {
+                return false;
+            }
+            memcpy(&v.d, p, sizeof(double));
+            p += sizeof(double);
+            v.i = (int64_t)v.d;
+            v.u = (uint64_t)v.d;
+            return true;
+        }
+        case LogArgs::STRING:
+        {
+            uint32_t len = 0;
+            if (end - p < (long)sizeof(len))
+            {
+                return false;
+            }
+            memcpy(&len, p, sizeof(len));
+            p += sizeof(len);
+            if ((uint64_t)(end - p) < len)
+            {
+                return false;
+            }
+            v.s.assign(p, len);
+            p += len;
+            return true;
+        }
+        default:
+            return false;
+        }
+    }
+
+    static void AppendFormat(std::string &out, const char *fmt, ...)
+    {
+        va_list al;
+        va_start(al, fmt);
+        char *buf = nullptr;
+        int len = vasprintf(&buf, fmt, al);
+        if (len != -1)
+        {
+            out.append(buf, len);
+            free(buf);
+        }
+        va_end(al);
+    }
+
+    std::string LogArgs::Render(const char *fmt, const std::string &args)
+    {
+        std::string out;
+        const char *p = args.data();
+        const char *end = p + args.size();
+        LogArgValue v;
+        while (*fmt)
+        {
+            if (*fmt != '%')
+            {
+                out.push_back(*fmt++);
+                continue;
+            }
+            if (fmt[1] == '%')
+            {
+                out.push_back('%');
+                fmt += 2;
+                continue;
+            }
+            // %[flags][width][.precision][length]conversion
+            std::string spec = "%";
+            const char *s = fmt + 1;
+            while (*s && strchr("-+ #0", *s))
+            {
+                spec.push_back(*s++);
+            }
+            // 宽度和精度为*时，从参数中取值
+            for (int part = 0; part < 2; ++part)
+            {
+                if (part == 1)
+                {
+                    if (*s != '.')
+                    {
+                        break;
+                    }
+                    spec.push_back(*s++);
+                }
+                if (*s == '*')
+                {
+                    ++s;
+                    if (DecodeLogArg(p, end, v))
+                    {
+                        spec += std::to_string(v.i);
+                    }
+                }
+                while (isdigit(*s))
+                {
+                    spec.push_back(*s++);
+                }
+            }
+            while (*s && strchr("hlLqjzt", *s))
+            {
+                ++s;
+            }
+            char conv = *s;
+            if (!conv)
+            {
+                break;
+            }
+            fmt = s + 1;
+
+            if (!DecodeLogArg(p, end, v))
+            {
+                out += "<<missing arg>>";
+                continue;
+            }
+            switch (conv)
+            {
+            case 'd':
+            case 'i':
+                AppendFormat(out, (spec + "lld").c_str(), (long long)v.i);
+                break;
+            case 'u':
+            case 'o':
+            case 'x':
+            case 'X':
+                AppendFormat(out, (spec + "ll" + conv).c_str(), (unsigned long long)v.u);
+                break;
+            case 'c':
+                AppendFormat(out, (spec + "c").c_str(), (int)v.i);
+                break;
+            case 'f':
+            case 'F':
+            case 'e':
+            case 'E':
+            case 'g':
+            case 'G':
+            case 'a':
+            case 'A':
+                AppendFormat(out, (spec + conv).c_str(), v.d);
+                break;
+            case 's':
+                if (v.type == STRING)
+                {
+                    AppendFormat(out, (spec + "s").c_str(), v.s.c_str());
+                }
+                else
+                {
+                    out += "<<not string>>";
+                }
+                break;
+            case 'p':
+                AppendFormat(out, (spec + "p").c_str(), (void *)(uintptr_t)v.u);
+                break;
+            default:
+                out += "<<error_format %";
+                out.push_back(conv);
+                out += ">>";
+                break;
+            }
+        }
+        return out;
+    }
+
     std::stringstream &LogEventWrap::getSS()
     {
         return m_event->getSS();
@@ -101,16 +345,19 @@ namespace sylar
     /**
      * Logger类的方法实现
      */
-    Logger::Logger(const std::string &name) : m_name(name), m_level(LogLevel::DEBUG)
+    Logger::Logger(const std::string &name)
+        : m_name(name), m_level(LogLevel::DEBUG),
+          // 日志名为root，默认有输出到控制台的appender
+          m_appenders(name == "root" ? std::make_shared<const AppenderList>(1, LogAppender::ptr(new StdoutLogAppender))
+                                     : std::make_shared<const AppenderList>())
     {
         // 设置初始化格式
         m_formatter.reset(new LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
-        // 设置appender
-        if (name == "root")
-        {
-            // 日志名为root，默认有输出到控制台的appender
-            m_appenders.push_back(LogAppender::ptr(new StdoutLogAppender));
-        }
+    }
+
+    Logger::AppenderListPtr Logger::getAppenders() const
+    {
+        return m_appenders.load();
     }
 
     void Logger::addAppender(LogAppender::ptr appender)
@@ -124,26 +371,54 @@ namespace sylar
             // appender->setFormatter(m_formatter);
             appender->m_formatter = m_formatter;
         }
-        m_appenders.push_back(appender);
+        // 写时复制,写日志的线程仍然使用旧的列表
+        std::shared_ptr<AppenderList> list(new AppenderList(*m_appenders.load()));
+        list->push_back(appender);
+        m_appenders.store(list);
+        lock.unlock();
+        Rcu::Collect();
     }
 
     void Logger::delAppender(LogAppender::ptr appender)
     {
         MutexType::Lock lock(m_mutex);
-        for (auto it = m_appenders.begin(); it != m_appenders.end(); it++)
+        std::shared_ptr<AppenderList> list(new AppenderList(*m_appenders.load()));
+        for (auto it = list->begin(); it != list->end(); it++)
         {
             if (*it == appender)
             {
-                m_appenders.erase(it);
+                list->erase(it);
+                m_appenders.store(list);
                 break;
             }
         }
+        lock.unlock();
+        // 释放锁后等持有旧列表的读者退出,不在调度器中时被移除的appender在返回前析构(关闭文件、连接)
+        Rcu::Collect();
+    }
+
+    void Logger::setAppenders(const AppenderList &appenders)
+    {
+        MutexType::Lock lock(m_mutex);
+        for (auto &i : appenders)
+        {
+            MutexType::Lock ll(i->m_mutex);
+            if (!i->m_hasFormatter)
+            {
+                i->m_formatter = m_formatter;
+            }
+        }
+        m_appenders.store(std::make_shared<const AppenderList>(appenders));
+        lock.unlock();
+        Rcu::Collect();
     }
 
     void Logger::clearAppenders()
     {
         MutexType::Lock lock(m_mutex);
-        m_appenders.clear();
+        m_appenders.store(std::make_shared<const AppenderList>());
+        lock.unlock();
+        Rcu::Collect();
     }
 
     void Logger::setFormatter(LogFormatter::ptr val)
@@ -152,7 +427,7 @@ namespace sylar
         // 设置自己的formatter
         m_formatter = val;
         // 设置下游的formatter,如果本身有自己的formatter就不需要再设置了
-        for (auto &i : m_appenders)
+        for (auto &i : *m_appenders.load())
         {
             MutexType::Lock ll(i->m_mutex);
             if (!i->m_hasFormatter)
@@ -190,14 +465,29 @@ namespace sylar
      */
     void Logger::log(LogLevel::Level level, LogEvent::ptr event)
     {
+        // 有调用点的丢弃条数未汇报时，最多每秒汇总一次
+        if (m_hasPending.load(std::memory_order_relaxed))
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+            uint64_t flushed = m_flushed.load(std::memory_order_relaxed);
+            if (now - flushed >= 1000000000ull &&
+                m_flushed.compare_exchange_strong(flushed, now, std::memory_order_relaxed))
+            {
+                flushSuppressed();
+            }
+        }
         // 仅输出级别>=m_level的日志
         if (level >= m_level)
         {
             auto self = shared_from_this();
-            MutexType::Lock lock(m_mutex);
-            if (!m_appenders.empty())
+            // 不加锁,在RCU读临界区内使用当前appender列表,修改列表时旧列表等读者退出后才释放
+            Rcu::ReadLock rcu;
+            const AppenderList *appenders = m_appenders.get();
+            if (!appenders->empty())
             {
-                for (auto &i : m_appenders)
+                for (auto &i : *appenders)
                 {
                     // 遍历每一个appender
                     i->log(self, level, event);
@@ -275,8 +565,19 @@ namespace sylar
         {
             node["formatter"] = m_formatter->getPattern();
         }
+        // limit
+        LogLimit limit = m_limit.load();
+        if (limit.rate)
+        {
+            node["rate"] = limit.rate;
+            node["burst"] = limit.burst;
+        }
+        if (limit.sample > 1)
+        {
+            node["sample"] = limit.sample;
+        }
         // appenders
-        for (auto &i : m_appenders)
+        for (auto &i : *m_appenders.load())
         {
             // 调用每个appender的toYamlString方法
             node["appenders"].push_back(YAML::Load(i->toYamlString()));
@@ -286,6 +587,138 @@ namespace sylar
         return ss.str();
     }
 
+    void Logger::setLimit(uint32_t rate, uint32_t burst, uint32_t sample)
+    {
+        LogLimit limit;
+        limit.rate = rate;
+        limit.burst = burst;
+        limit.sample = sample;
+        m_limit.store(limit);
+        m_limited = rate > 0 || sample > 1;
+    }
+
+    bool Logger::allowSlow(LogSite &static_site, LogLevel::Level level, const char *file, int32_t line)
+    {
+        // 调用点的静态状态归第一个经过的日志器，其他日志器使用自己表中的状态
+        LogSite *s = &static_site;
+        uint64_t owner = s->owner.load(std::memory_order_acquire);
+        if (owner != m_id && !(owner == 0 && s->owner.compare_exchange_strong(owner, m_id)))
+        {
+            Mutex::Lock lock(m_siteMutex);
+            std::unique_ptr<LogSite> &local = m_sites[&static_site];
+            if (!local)
+            {
+                local.reset(new LogSite);
+            }
+            s = local.get();
+        }
+        LogSite &site = *s;
+
+        LogLimit limit = m_limit.load();
+        // 采样: 每sample条保留1条
+        uint32_t sample = limit.sample;
+        if (sample > 1 && site.count.fetch_add(1, std::memory_order_relaxed) % sample != 0)
+        {
+            suppress(site, level, file, line);
+            return false;
+        }
+
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+
+        // 令牌桶: 使用GCRA算法，只需要一个原子变量
+        uint32_t rate = limit.rate;
+        if (rate > 0)
+        {
+            uint64_t interval = 1000000000ull / rate;
+            uint64_t tolerance = interval * std::max(limit.burst, 1u);
+            uint64_t tat = site.tat.load(std::memory_order_relaxed);
+            while (true)
+            {
+                uint64_t next = std::max(tat, now) + interval;
+                if (next - now > tolerance)
+                {
+                    suppress(site, level, file, line);
+                    return false;
+                }
+                if (site.tat.compare_exchange_weak(tat, next, std::memory_order_relaxed))
+                {
+                    break;
+                }
+            }
+        }
+
+        // 每秒最多汇报一次被丢弃的条数
+        uint64_t reported = site.reported.load(std::memory_order_relaxed);
+        if (site.suppressed.load(std::memory_order_relaxed) && now - reported >= 1000000000ull &&
+            site.reported.compare_exchange_strong(reported, now, std::memory_order_relaxed))
+        {
+            uint64_t suppressed = site.suppressed.exchange(0, std::memory_order_relaxed);
+            if (suppressed)
+            {
+                reportSuppressed(level, file, line, suppressed);
+            }
+        }
+        return true;
+    }
+
+    void Logger::suppress(LogSite &site, LogLevel::Level level, const char *file, int32_t line)
+    {
+        site.suppressed.fetch_add(1, std::memory_order_relaxed);
+        if (site.pending.load(std::memory_order_relaxed) || site.pending.exchange(true))
+        {
+            return;
+        }
+        Mutex::Lock lock(m_siteMutex);
+        site.file = file;
+        site.line = line;
+        site.level = level;
+        m_pending.push_back(&site);
+        m_hasPending = true;
+    }
+
+    void Logger::flushSuppressed()
+    {
+        std::vector<LogSite *> sites;
+        {
+            Mutex::Lock lock(m_siteMutex);
+            sites.swap(m_pending);
+            m_hasPending = false;
+        }
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        uint64_t now = ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        for (auto i : sites)
+        {
+            // 先清除登记标记，之后的丢弃会重新登记(重写file等字段)，不会漏计
+            LogLevel::Level level = i->level;
+            const char *file = i->file;
+            int32_t line = i->line;
+            i->pending = false;
+            uint64_t suppressed = i->suppressed.exchange(0);
+            if (suppressed)
+            {
+                i->reported.store(now, std::memory_order_relaxed);
+                reportSuppressed(level, file, line, suppressed);
+            }
+        }
+    }
+
+    uint64_t Logger::NextId()
+    {
+        static std::atomic<uint64_t> s_id{0};
+        return ++s_id;
+    }
+
+    void Logger::reportSuppressed(LogLevel::Level level, const char *file, int32_t line, uint64_t suppressed)
+    {
+        LogEvent::ptr event(new LogEvent(shared_from_this(), level, file, line, 0, GetThreadId(),
+                                         GetFiberId(), time(0), GetThreadName()));
+        event->getSS() << "suppressed " << suppressed << " messages";
+        log(level, event);
+    }
+
     /**
      * StdoutLogAppender类的方法实现
      */
@@ -9,6 +9,8 @@
 #include <map>
 #include <sstream>
 #include <fstream>
+#include <type_traits>
+#include <atomic>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -19,14 +21,35 @@
 
 /**
  * 使用流式方式将日志级别level的日志写入到logger
+ * 每个调用点有一个静态的LogSite，被限流或采样丢弃时不会构造LogEvent
  */
 #define SYLAR_LOG_LEVEL(logger, level)                                                                                   \
-    if (logger->getLevel() <= level)                                                                                     \
+    if (static sylar::LogSite s_sylar_log_site;                                                                          \
+        logger->getLevel() <= level && logger->allow(s_sylar_log_site, level, __FILE__, __LINE__))                       \
     sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level,                                          \
                                                                  __FILE__, __LINE__, 0, sylar::GetThreadId(),            \
                                                                  sylar::GetFiberId(), time(0), sylar::GetThreadName()))) \
         .getSS()
 
+/**
+ * 使用格式化方式将日志级别level的日志写入到logger
+ * 调用点只记录格式串和原始参数，文本在appender需要时才生成
+ */
+#define SYLAR_LOG_FMT_LEVEL(logger, level, fmt, ...)                                                                     \
+    if (static sylar::LogSite s_sylar_log_site;                                                                          \
+        logger->getLevel() <= level && logger->allow(s_sylar_log_site, level, __FILE__, __LINE__))                       \
+    sylar::LogEventWrap(sylar::LogEvent::ptr(new sylar::LogEvent(logger, level,                                          \
+                                                                 __FILE__, __LINE__, 0, sylar::GetThreadId(),            \
+                                                                 sylar::GetFiberId(), time(0), sylar::GetThreadName()))) \
+        .getEvent()                                                                                                      \
+        ->formatArgs(fmt, ##__VA_ARGS__)
+
+#define SYLAR_LOG_FMT_DEBUG(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::DEBUG, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMT_INFO(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::INFO, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMT_WARN(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::WARN, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMT_ERROR(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::ERROR, fmt, ##__VA_ARGS__)
+#define SYLAR_LOG_FMT_FATAL(logger, fmt, ...) SYLAR_LOG_FMT_LEVEL(logger, sylar::LogLevel::FATAL, fmt, ##__VA_ARGS__)
+
 /**
  * @brief 使用流式方式将日志级别debug的日志写入到logger
  */
@@ -88,6 +111,93 @@ namespace sylar
         static LogLevel::Level FromString(const std::string &str);
     };
 
+    /**
+     * 日志参数的二进制编码
+     * 按类型记录printf风格的参数: 1字节类型 + 定长数值 / u32长度+字符串
+     * 文本appender或离线解码时再根据格式串还原成文本
+     */
+    class LogArgs
+    {
+    public:
+        enum Type
+        {
+            INT32 = 1,
+            INT64 = 2,
+            UINT32 = 3,
+            UINT64 = 4,
+            DOUBLE = 5,
+            STRING = 6,
+            POINTER = 7,
+        };
+
+        static void Encode(std::string &) {}
+
+        /**
+         * 依次编码所有参数,追加到out
+         */
+        template <class T, class... Args>
+        static void Encode(std::string &out, const T &v, const Args &...args)
+        {
+            EncodeOne(out, v);
+            Encode(out, args...);
+        }
+
+        /**
+         * 按照格式串fmt将编码后的参数还原为文本
+         * 长度修饰符(l/ll/h等)被忽略，以参数记录的实际类型为准
+         */
+        static std::string Render(const char *fmt, const std::string &args);
+
+    private:
+        template <class T>
+        static void Put(std::string &out, Type type, T v)
+        {
+            out.push_back((char)type);
+            out.append((const char *)&v, sizeof(v));
+        }
+
+        static void EncodeOne(std::string &out, const char *v);
+        static void EncodeOne(std::string &out, const std::string &v);
+
+        template <class T>
+        static typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+        EncodeOne(std::string &out, T v)
+        {
+            if (std::is_signed<T>::value)
+            {
+                if (sizeof(T) <= 4)
+                {
+                    Put(out, INT32, (int32_t)v);
+                }
+                else
+                {
+                    Put(out, INT64, (int64_t)v);
+                }
+            }
+            else if (sizeof(T) <= 4)
+            {
+                Put(out, UINT32, (uint32_t)v);
+            }
+            else
+            {
+                Put(out, UINT64, (uint64_t)v);
+            }
+        }
+
+        template <class T>
+        static typename std::enable_if<std::is_floating_point<T>::value>::type
+        EncodeOne(std::string &out, T v)
+        {
+            Put(out, DOUBLE, (double)v);
+        }
+
+        template <class T>
+        static void EncodeOne(std::string &out, const T *v)
+        {
+            Put(out, POINTER, (uint64_t)(uintptr_t)v);
+        }
+    };
+
     /**
      * 日志事件
      */
@@ -139,8 +249,10 @@ namespace sylar
         uint64_t getTime() const { return m_time; }
         /**
          * 返回日志内容
+         * 格式化方式写入的日志在第一次获取时才生成文本,之后返回缓存的文本
+         * (同一个事件的多个appender只格式化一次,事件只在记录日志的线程中使用)
          */
-        std::string getContent() const { return m_ss.str(); }
+        const std::string &getContent() const;
 
         std::stringstream &getSS() { return m_ss; }
 
@@ -169,6 +281,36 @@ namespace sylar
          */
         void format(const char *fmt, va_list al);
 
+        /**
+         * 记录格式串和原始参数，不在调用点格式化
+         * fmt 需要在事件的生命周期内有效(一般为字符串字面量)
+         */
+        template <class... Args>
+        void formatArgs(const char *fmt, const Args &...args)
+        {
+            m_fmt = fmt;
+            LogArgs::Encode(m_args, args...);
+        }
+
+        /**
+         * 直接设置格式串和已编码的参数(离线解码时使用)
+         */
+        void setFormatArgs(const char *fmt, const std::string &args)
+        {
+            m_fmt = fmt;
+            m_args = args;
+        }
+
+        /**
+         * 返回格式串，流式日志为nullptr
+         */
+        const char *getFmt() const { return m_fmt; }
+
+        /**
+         * 返回编码后的参数
+         */
+        const std::string &getArgs() const { return m_args; }
+
     private:
         const char *m_file = nullptr;     // 文件名
         int32_t m_line = 0;               // 行号
@@ -180,6 +322,10 @@ namespace sylar
         std::stringstream m_ss;           // 日志内容流
         std::shared_ptr<Logger> m_logger; // 日志器
         LogLevel::Level m_level;          // 日志等级
+        const char *m_fmt = nullptr;      // 格式串(格式化方式写入时)
+        std::string m_args;               // 编码后的参数
+        mutable std::string m_content;    // 第一次获取时生成的日志内容
+        mutable bool m_rendered = false;  // m_content是否已生成
     };
 
     /**
@@ -296,8 +442,8 @@ namespace sylar
 
     public:
         typedef std::shared_ptr<LogAppender> ptr;
-        // 定义锁地类型，此处为自旋锁
-        typedef Spinlock MutexType;
+        // 定义锁地类型，自适应锁，短暂自旋后睡眠，持有者被调度出去时不会空转
+        typedef AdaptiveMutex MutexType;
 
         /**
          * 虚析构函数
@@ -328,6 +474,11 @@ namespace sylar
          */
         void setLevel(LogLevel::Level val) { m_level = val; }
 
+        /**
+         * 锁的竞争统计
+         */
+        MutexType::Stats getLockStats() const { return m_mutex.getStats(); }
+
     protected:
         LogLevel::Level m_level = LogLevel::DEBUG;
         // 是否有自己的日志格式器
@@ -337,6 +488,35 @@ namespace sylar
         LogFormatter::ptr m_formatter;
     };
 
+    /**
+     * 日志器的限流参数,整体读写,不会读到一半新一半旧的配置
+     */
+    struct LogLimit
+    {
+        uint32_t rate = 0;   // 每个调用点每秒最多输出的条数
+        uint32_t burst = 0;  // 每个调用点允许的突发条数
+        uint32_t sample = 0; // 每个调用点采样比例 1/N
+    };
+
+    /**
+     * 调用点的限流状态，由日志宏定义为静态变量，多线程共享
+     * 静态变量属于调用点而不属于日志器，第一个经过的日志器使用它，
+     * 其他日志器经过同一调用点时(logger是变量)在各自的表中另建一份状态，互不影响;
+     * 归属按日志器的id记录，日志器被删除或替换(新对象可能复用同一地址)后，新日志器不会误用旧状态
+     */
+    struct LogSite
+    {
+        std::atomic<uint64_t> count{0};      // 经过采样判断的次数
+        std::atomic<uint64_t> tat{0};        // 令牌桶(GCRA)下一条日志的理论到达时间，单位纳秒
+        std::atomic<uint64_t> suppressed{0}; // 上次汇总后被丢弃的条数
+        std::atomic<uint64_t> reported{0};   // 上次输出汇总的时间，单位纳秒
+        std::atomic<uint64_t> owner{0};      // 使用这份状态的日志器id，0表示还没有归属
+        std::atomic<bool> pending{false};    // 是否已登记到日志器的待汇总列表
+        const char *file = nullptr;          // 登记时记录，汇总日志使用
+        int32_t line = 0;
+        LogLevel::Level level = LogLevel::UNKNOW;
+    };
+
     // 日志器
     class Logger : public std::enable_shared_from_this<Logger>
     {
@@ -345,7 +525,9 @@ namespace sylar
 
     public:
         typedef std::shared_ptr<Logger> ptr;
-        typedef Spinlock MutexType;
+        typedef AdaptiveMutex MutexType;
+        typedef std::vector<LogAppender::ptr> AppenderList;
+        typedef std::shared_ptr<const AppenderList> AppenderListPtr;
 
         /**
          * 构造函数
@@ -404,8 +586,18 @@ namespace sylar
          */
         void clearAppenders();
 
+        /**
+         * 获取当前日志目标列表的快照，列表本身不可修改
+         */
+        AppenderListPtr getAppenders() const;
+
+        /**
+         * 一次性替换全部日志目标，替换过程中写日志不会落到主日志器
+         */
+        void setAppenders(const AppenderList &appenders);
+
         // 获取日志名称
-        const std::string getName() const
+        const std::string &getName() const
         {
             return m_name;
         }
@@ -443,13 +635,72 @@ namespace sylar
          */
         std::string toYamlString();
 
+        /**
+         * @brief 设置每个调用点的限流和采样
+         * @param rate 每秒最多输出的条数，0表示不限流
+         * @param burst 允许的突发条数
+         * @param sample 每sample条输出1条，0和1表示不采样
+         */
+        void setLimit(uint32_t rate, uint32_t burst, uint32_t sample);
+
+        /**
+         * @brief 调用点site的日志是否可以输出，在构造LogEvent之前调用
+         * 没有配置限流时只有一次原子读
+         */
+        bool allow(LogSite &site, LogLevel::Level level, const char *file, int32_t line)
+        {
+            return !m_limited.load(std::memory_order_relaxed) || allowSlow(site, level, file, line);
+        }
+
+        /**
+         * @brief 输出所有调用点被丢弃条数的汇总
+         * 该日志器每次写日志时最多每秒自动执行一次，之后没有再输出的调用点也会汇报;
+         * 整个日志器都不再写日志时，可以由定时任务调用
+         */
+        void flushSuppressed();
+
+        /**
+         * 锁的竞争统计
+         */
+        MutexType::Stats getLockStats() const { return m_mutex.getStats(); }
+
+    private:
+        /**
+         * 执行采样和令牌桶判断，有日志被丢弃时每秒最多输出一条汇总
+         */
+        bool allowSlow(LogSite &site, LogLevel::Level level, const char *file, int32_t line);
+
+        /**
+         * 记录一条被丢弃的日志，调用点第一次有丢弃时登记到待汇总列表
+         */
+        void suppress(LogSite &site, LogLevel::Level level, const char *file, int32_t line);
+
+        /**
+         * 输出一条"suppressed N messages"汇总
+         */
+        void reportSuppressed(LogLevel::Level level, const char *file, int32_t line, uint64_t suppressed);
+
+        /**
+         * 分配日志器id，从1开始递增，不会重复使用
+         */
+        static uint64_t NextId();
+
     private:
         std::string m_name;                        // 名称
+        const uint64_t m_id = NextId();            // 唯一id，标记静态调用点状态的归属
         LogLevel::Level m_level;                   // 日志级别
-        std::vector<LogAppender::ptr> m_appenders; // Appender集合
+        // Appender集合,写时复制,写日志时在RCU读临界区内直接使用当前列表,不加锁也不修改引用计数
+        RcuPtr<const AppenderList> m_appenders{std::make_shared<const AppenderList>()};
         LogFormatter::ptr m_formatter;             // 日志格式器
-        MutexType m_mutex;                         // Mutex
+        MutexType m_mutex;                         // Mutex,只用于串行化修改
         Logger::ptr m_root;                        // 主日志器 如果该日志器的appender为空，则将日志输出到主日志器中
+        std::atomic<bool> m_limited{false};        // 是否配置了限流或采样
+        SeqLock<LogLimit> m_limit;                 // 限流参数,读取时不写共享内存
+        Mutex m_siteMutex;                         // 保护m_sites和m_pending
+        std::map<const LogSite *, std::unique_ptr<LogSite>> m_sites; // 与其他日志器共用的调用点在本日志器中的状态
+        std::vector<LogSite *> m_pending;          // 有未汇总丢弃条数的调用点
+        std::atomic<bool> m_hasPending{false};     // m_pending是否非空
+        std::atomic<uint64_t> m_flushed{0};        // 上次自动汇总的时间，单位纳秒
     };
 
     // 输出到控制台
@@ -501,7 +752,7 @@ namespace sylar
     class LoggerManager
     {
     public:
-        typedef Spinlock MutexType;
+        typedef AdaptiveMutex MutexType;
 
         /**
          * 构造函数
@@ -532,6 +783,11 @@ namespace sylar
          */
         std::string toYamlString();
 
+        /**
+         * 锁的竞争统计
+         */
+        MutexType::Stats getLockStats() const { return m_mutex.getStats(); }
+
     private:
         MutexType m_mutex;                            // Mutex
         std::map<std::string, Logger::ptr> m_loggers; // 日志器容器,根据名称获取日志类
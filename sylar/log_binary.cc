@@ -0,0 +1,345 @@
+#include "log_binary.h"
+#include "config.h"
+
+namespace sylar
+{
+    static void PutU8(std::string &out, uint8_t v)
+    {
+        out.push_back((char)v);
+    }
+
+    static void PutU32(std::string &out, uint32_t v)
+    {
+        out.append((const char *)&v, sizeof(v));
+    }
+
+    static void PutU64(std::string &out, uint64_t v)
+    {
+        out.append((const char *)&v, sizeof(v));
+    }
+
+    static void PutStr(std::string &out, const std::string &v)
+    {
+        PutU32(out, v.size());
+        out.append(v);
+    }
+
+    // 开始一条记录,长度先占位
+    static void BeginRecord(std::string &out, BinaryLog::RecordType type)
+    {
+        out.clear();
+        PutU8(out, type);
+        PutU32(out, 0);
+    }
+
+    // 回填记录长度
+    static void EndRecord(std::string &out)
+    {
+        uint32_t len = out.size() - 5;
+        memcpy(&out[1], &len, sizeof(len));
+    }
+
+    /**
+     * BinaryLogAppender类的方法实现
+     */
+    BinaryLogAppender::BinaryLogAppender(const std::string &filename) : m_filename(filename)
+    {
+        reopen();
+    }
+
+    BinaryLogAppender::~BinaryLogAppender()
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_filestream.is_open())
+        {
+            m_filestream.flush();
+            m_filestream.close();
+        }
+    }
+
+    bool BinaryLogAppender::reopen()
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_filestream.is_open())
+        {
+            m_filestream.flush();
+            m_filestream.close();
+        }
+        m_filestream.clear();
+        m_filestream.open(m_filename, std::ios::out | std::ios::app | std::ios::binary);
+        if (!m_filestream)
+        {
+            return false;
+        }
+        // 新的文件头,之前的字典作废
+        m_sites.clear();
+        m_loggers.clear();
+        BeginRecord(m_buffer, BinaryLog::HEADER);
+        PutU32(m_buffer, BinaryLog::MAGIC);
+        PutU32(m_buffer, BinaryLog::VERSION);
+        EndRecord(m_buffer);
+        m_filestream.write(m_buffer.data(), m_buffer.size());
+        m_filestream.flush();
+        m_unflushed = 0;
+        m_lastFlush = time(0);
+        return !!m_filestream;
+    }
+
+    void BinaryLogAppender::flush()
+    {
+        MutexType::Lock lock(m_mutex);
+        if (m_filestream)
+        {
+            m_filestream.flush();
+        }
+        m_unflushed = 0;
+    }
+
+    void BinaryLogAppender::write()
+    {
+        m_filestream.write(m_buffer.data(), m_buffer.size());
+        m_unflushed += m_buffer.size();
+    }
+
+    uint32_t BinaryLogAppender::getSiteId(LogEvent::ptr event)
+    {
+        SiteKey key{event->getFile(), event->getLine(), event->getFmt()};
+        auto it = m_sites.find(key);
+        if (it != m_sites.end())
+        {
+            return it->second;
+        }
+        uint32_t id = m_sites.size() + 1;
+        m_sites.emplace(key, id);
+        BeginRecord(m_buffer, BinaryLog::SITE);
+        PutU32(m_buffer, id);
+        PutU32(m_buffer, (uint32_t)key.line);
+        PutStr(m_buffer, key.file ? key.file : "");
+        PutStr(m_buffer, key.fmt ? key.fmt : "");
+        EndRecord(m_buffer);
+        write();
+        return id;
+    }
+
+    uint32_t BinaryLogAppender::getLoggerId(const std::string &name)
+    {
+        auto it = m_loggers.find(name);
+        if (it != m_loggers.end())
+        {
+            return it->second;
+        }
+        uint32_t id = m_loggers.size() + 1;
+        m_loggers.emplace(name, id);
+        BeginRecord(m_buffer, BinaryLog::LOGGER);
+        PutU32(m_buffer, id);
+        PutStr(m_buffer, name);
+        EndRecord(m_buffer);
+        write();
+        return id;
+    }
+
+    void BinaryLogAppender::log(std::shared_ptr<Logger>, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level >= m_level)
+        {
+            MutexType::Lock lock(m_mutex);
+            if (!m_filestream)
+            {
+                return;
+            }
+            uint32_t site = getSiteId(event);
+            uint32_t logger_id = getLoggerId(event->getLogger()->getName());
+
+            BeginRecord(m_buffer, BinaryLog::EVENT);
+            PutU32(m_buffer, site);
+            PutU32(m_buffer, logger_id);
+            PutU8(m_buffer, level);
+            PutU64(m_buffer, event->getTime());
+            PutU32(m_buffer, event->getElapse());
+            PutU32(m_buffer, event->getThreadId());
+            PutU32(m_buffer, event->getFiberId());
+            PutStr(m_buffer, event->getThreadName());
+            if (event->getFmt())
+            {
+                // 格式化日志,直接写入原始参数
+                m_buffer.append(event->getArgs());
+            }
+            else
+            {
+                // 流式日志,内容作为"%s"的参数
+                LogArgs::Encode(m_buffer, event->getSS().str());
+            }
+            EndRecord(m_buffer);
+            if (m_buffer.size() - 5 > BinaryLog::MAX_RECORD)
+            {
+                // 读取时会被视为损坏,丢弃
+                return;
+            }
+            write();
+            // 按数据量和时间批量写入文件,进程异常退出时最多丢失FLUSH_SECONDS秒的日志
+            uint64_t now = event->getTime();
+            if (m_unflushed >= FLUSH_BYTES || now >= m_lastFlush + FLUSH_SECONDS)
+            {
+                m_filestream.flush();
+                m_unflushed = 0;
+                m_lastFlush = now;
+            }
+        }
+    }
+
+    std::string BinaryLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "BinaryLogAppender";
+        node["file"] = m_filename;
+        if (m_level != LogLevel::UNKNOW)
+        {
+            node["level"] = LogLevel::ToString(m_level);
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+
+    /**
+     * BinaryLogReader类的方法实现
+     */
+    BinaryLogReader::BinaryLogReader(const std::string &filename)
+    {
+        m_filestream.open(filename, std::ios::in | std::ios::binary | std::ios::ate);
+        if (m_filestream)
+        {
+            m_size = m_filestream.tellg();
+            m_filestream.seekg(0);
+        }
+    }
+
+    // 从payload中依次读取字段
+    class PayloadReader
+    {
+    public:
+        PayloadReader(const std::string &data) : m_p(data.data()), m_end(data.data() + data.size()) {}
+
+        template <class T>
+        bool get(T &v)
+        {
+            if (m_end - m_p < (long)sizeof(T))
+            {
+                return false;
+            }
+            memcpy(&v, m_p, sizeof(T));
+            m_p += sizeof(T);
+            return true;
+        }
+
+        bool getStr(std::string &v)
+        {
+            uint32_t len = 0;
+            if (!get(len) || (uint64_t)(m_end - m_p) < len)
+            {
+                return false;
+            }
+            v.assign(m_p, len);
+            m_p += len;
+            return true;
+        }
+
+        std::string rest() const { return std::string(m_p, m_end); }
+
+    private:
+        const char *m_p;
+        const char *m_end;
+    };
+
+    bool BinaryLogReader::read(LogEvent::ptr &event)
+    {
+        while (m_filestream)
+        {
+            uint8_t type = 0;
+            uint32_t len = 0;
+            if (!m_filestream.read((char *)&type, sizeof(type)) ||
+                !m_filestream.read((char *)&len, sizeof(len)))
+            {
+                return false;
+            }
+            // 长度来自文件,超过上限或剩余的文件大小时视为损坏,不按它分配内存
+            uint64_t pos = m_filestream.tellg();
+            if (len > BinaryLog::MAX_RECORD || pos > m_size || len > m_size - pos)
+            {
+                return false;
+            }
+            m_payload.resize(len);
+            if (!m_filestream.read(&m_payload[0], len))
+            {
+                return false;
+            }
+            PayloadReader r(m_payload);
+            switch (type)
+            {
+            case BinaryLog::HEADER:
+            {
+                uint32_t magic = 0, version = 0;
+                if (!r.get(magic) || !r.get(version) || magic != BinaryLog::MAGIC || version > BinaryLog::VERSION)
+                {
+                    return false;
+                }
+                m_sites.clear();
+                m_loggers.clear();
+                break;
+            }
+            case BinaryLog::LOGGER:
+            {
+                uint32_t id = 0;
+                std::string name;
+                if (!r.get(id) || !r.getStr(name))
+                {
+                    return false;
+                }
+                // 只用于还原日志名称,不注册到LoggerManager
+                m_loggers[id].reset(new Logger(name, LogLevel::DEBUG));
+                break;
+            }
+            case BinaryLog::SITE:
+            {
+                uint32_t id = 0;
+                Site site;
+                if (!r.get(id) || !r.get(site.line) || !r.getStr(site.file) || !r.getStr(site.fmt))
+                {
+                    return false;
+                }
+                m_sites[id] = site;
+                break;
+            }
+            case BinaryLog::EVENT:
+            {
+                uint32_t site_id = 0, logger_id = 0, elapse = 0, thread_id = 0, fiber_id = 0;
+                uint8_t level = 0;
+                uint64_t time = 0;
+                std::string thread_name;
+                if (!r.get(site_id) || !r.get(logger_id) || !r.get(level) || !r.get(time) || !r.get(elapse) ||
+                    !r.get(thread_id) || !r.get(fiber_id) || !r.getStr(thread_name))
+                {
+                    return false;
+                }
+                auto sit = m_sites.find(site_id);
+                auto lit = m_loggers.find(logger_id);
+                if (sit == m_sites.end() || lit == m_loggers.end())
+                {
+                    return false;
+                }
+                const Site &site = sit->second;
+                event.reset(new LogEvent(lit->second, (LogLevel::Level)level, site.file.c_str(), site.line,
+                                         elapse, thread_id, fiber_id, time, thread_name));
+                // 流式日志的调用点没有格式串,内容作为"%s"的参数
+                event->setFormatArgs(site.fmt.empty() ? "%s" : site.fmt.c_str(), r.rest());
+                return true;
+            }
+            default:
+                // 未知记录,跳过
+                break;
+            }
+        }
+        return false;
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef __SYLAR_LOG_BINARY_H__
+#define __SYLAR_LOG_BINARY_H__
+
+#include "log.h"
+#include <unordered_map>
+
+/**
+ * 二进制日志
+ * 写日志时不生成文本，只记录调用点id、时间、线程/协程id和原始参数
+ * 需要查看时使用sylar-logcat按照LogFormatter的模板离线还原
+ *
+ * 文件由若干条记录组成: type(u8) + len(u32) + payload(len字节)
+ *  HEADER : magic(u32) version(u32)    每次打开文件时写入,解码器遇到后清空字典
+ *  LOGGER : id(u32) name(str)          日志器名称字典
+ *  SITE   : id(u32) line(i32) file(str) fmt(str)   调用点字典,流式日志fmt为空
+ *  EVENT  : site(u32) logger(u32) level(u8) time(u64) elapse(u32)
+ *           thread_id(u32) fiber_id(u32) thread_name(str) args(剩余字节)
+ * str 为 u32长度 + 内容
+ */
+
+namespace sylar
+{
+    class BinaryLog
+    {
+    public:
+        enum RecordType
+        {
+            HEADER = 1,
+            LOGGER = 2,
+            SITE = 3,
+            EVENT = 4,
+        };
+
+        static const uint32_t MAGIC = 0x534c4f47; // "SLOG"
+        static const uint32_t VERSION = 1;
+        static const uint32_t MAX_RECORD = 16 << 20; // 一条记录payload的最大长度,读取时超过视为损坏
+    };
+
+    // 输出到二进制文件
+    class BinaryLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<BinaryLogAppender> ptr;
+        BinaryLogAppender(const std::string &filename);
+
+        /**
+         * 写出缓冲并关闭文件
+         */
+        ~BinaryLogAppender();
+
+        void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+        std::string toYamlString() override;
+
+        /**
+         * 重新打开文件(追加写)，写入新的文件头并清空字典
+         */
+        bool reopen();
+
+        /**
+         * 把缓冲中的记录写入文件
+         * 写日志时未写入的数据超过FLUSH_BYTES或距上次写入超过FLUSH_SECONDS秒时自动调用
+         */
+        void flush();
+
+    private:
+        /**
+         * 调用点: 文件名、行号、格式串的地址均来自字面量,直接按地址区分
+         */
+        struct SiteKey
+        {
+            const char *file;
+            int32_t line;
+            const char *fmt;
+
+            bool operator==(const SiteKey &oth) const
+            {
+                return file == oth.file && line == oth.line && fmt == oth.fmt;
+            }
+        };
+
+        struct SiteKeyHash
+        {
+            size_t operator()(const SiteKey &k) const
+            {
+                return std::hash<const void *>()(k.file) ^ (std::hash<const void *>()(k.fmt) << 1) ^ (size_t)k.line;
+            }
+        };
+
+        uint32_t getSiteId(LogEvent::ptr event);
+        uint32_t getLoggerId(const std::string &name);
+
+        /**
+         * 写入一条编码好的记录,需持有m_mutex
+         */
+        void write();
+
+    private:
+        static const uint64_t FLUSH_BYTES = 64 * 1024; // 未写入文件的数据量上限
+        static const uint64_t FLUSH_SECONDS = 1;       // 未写入文件的时间上限
+
+        std::string m_filename;                                         // 文件路径
+        std::ofstream m_filestream;                                     // 文件流
+        std::string m_buffer;                                           // 一条日志的编码缓冲
+        std::unordered_map<SiteKey, uint32_t, SiteKeyHash> m_sites;     // 调用点字典
+        std::unordered_map<std::string, uint32_t> m_loggers;            // 日志器名称字典
+        uint64_t m_unflushed = 0;                                       // 上次flush之后写入的字节数
+        uint64_t m_lastFlush = 0;                                       // 上次flush的时间,秒
+    };
+
+    /**
+     * 二进制日志读取器，sylar-logcat使用
+     */
+    class BinaryLogReader
+    {
+    public:
+        BinaryLogReader(const std::string &filename);
+
+        /**
+         * 文件是否打开成功
+         */
+        bool isOpen() const { return !!m_filestream; }
+
+        /**
+         * 读取下一条日志，返回false表示文件结束或数据损坏
+         * 返回的事件引用了读取器内部的字典，需在下一次read前使用
+         */
+        bool read(LogEvent::ptr &event);
+
+    private:
+        struct Site
+        {
+            int32_t line = 0;
+            std::string file;
+            std::string fmt;
+        };
+
+    private:
+        std::ifstream m_filestream;
+        uint64_t m_size = 0; // 文件大小
+        std::string m_payload;
+        std::unordered_map<uint32_t, Site> m_sites;
+        std::unordered_map<uint32_t, Logger::ptr> m_loggers;
+    };
+}
+
+#endif
@@ -2,6 +2,8 @@
 #define __SYLAR_LOG_CONFIG_H__
 
 #include "log.h"
+#include "log_binary.h"
+#include "log_shm.h"
 #include "config.h"
 #include <iostream>
 #include <string.h>
@@ -16,7 +18,7 @@ namespace sylar
     struct LogAppenderDefine
     {
         // 具体的yaml文件中appender定义
-        int type; // 1 File,2 Stdout
+        int type; // 1 File,2 Stdout,3 Binary,4 Shm
         LogLevel::Level level = LogLevel::UNKNOW;
         std::string formatter;
         std::string file;
@@ -37,6 +39,9 @@ namespace sylar
         std::string name;
         LogLevel::Level level = LogLevel::UNKNOW;
         std::string formatter;
+        uint32_t rate = 0;   // 每个调用点每秒最多输出的条数，0不限流
+        uint32_t burst = 0;  // 每个调用点允许的突发条数，默认等于rate
+        uint32_t sample = 0; // 每个调用点每sample条输出1条
         std::vector<LogAppenderDefine> appenders;
 
         // 重载等于运算符，ConfigVar->setValue会用到
@@ -45,6 +50,9 @@ namespace sylar
             return name == oth.name &&
                    level == oth.level &&
                    formatter == oth.formatter &&
+                   rate == oth.rate &&
+                   burst == oth.burst &&
+                   sample == oth.sample &&
                    appenders == oth.appenders;
         }
 
@@ -60,15 +68,14 @@ namespace sylar
     };
 
     /**
-     * string -> LogDefine
+     * YAML::Node -> LogDefine
      */
     template <>
-    class LexicalCast<std::string, LogDefine>
+    class LexicalCast<YAML::Node, LogDefine>
     {
     public:
-        LogDefine operator()(const std::string &v)
+        LogDefine operator()(const YAML::Node &n)
         {
-            YAML::Node n = YAML::Load(v); // 将字符串使用yaml-cpp加载
             LogDefine ld;
             if (!n["name"].IsDefined())
             {
@@ -86,8 +93,22 @@ namespace sylar
             {
                 ld.formatter = n["formatter"].as<std::string>();
             }
+            // 设置限流和采样
+            if (n["rate"].IsDefined())
+            {
+                ld.rate = n["rate"].as<uint32_t>();
+                ld.burst = ld.rate;
+            }
+            if (n["burst"].IsDefined())
+            {
+                ld.burst = n["burst"].as<uint32_t>();
+            }
+            if (n["sample"].IsDefined())
+            {
+                ld.sample = n["sample"].as<uint32_t>();
+            }
             // 设置appender
-            if (n["formatter"].IsDefined())
+            if (n["appenders"].IsDefined())
             {
                 // 遍历YAML树中n["appenders"]的每一个节点
                 for (size_t x = 0; x < n["appenders"].size(); x++)
@@ -125,6 +146,34 @@ namespace sylar
                             lad.formatter = a["formatter"].as<std::string>();
                         }
                     }
+                    else if (type == "BinaryLogAppender")
+                    {
+                        // 二进制日志不需要formatter,由sylar-logcat解码时指定
+                        lad.type = 3;
+                        if (!a["file"].IsDefined())
+                        {
+                            std::cout << "log config error: binaryappender file is null, " << a
+                                      << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<std::string>();
+                    }
+                    else if (type == "ShmLogAppender")
+                    {
+                        // file为共享内存名称,如/sylar_log
+                        lad.type = 4;
+                        if (!a["file"].IsDefined())
+                        {
+                            std::cout << "log config error: shmappender file is null, " << a
+                                      << std::endl;
+                            continue;
+                        }
+                        lad.file = a["file"].as<std::string>();
+                        if (a["formatter"].IsDefined())
+                        {
+                            lad.formatter = a["formatter"].as<std::string>();
+                        }
+                    }
                     else
                     {
                         std::cout << "log config error: appender type is invalid, " << a
@@ -141,13 +190,27 @@ namespace sylar
     };
 
     /**
-     * LogDefine -> string
+     * string -> LogDefine
      */
     template <>
-    class LexicalCast<LogDefine, std::string>
+    class LexicalCast<std::string, LogDefine>
     {
     public:
-        std::string operator()(const LogDefine &i)
+        LogDefine operator()(const std::string &v)
+        {
+            // 将字符串使用yaml-cpp加载
+            return LexicalCast<YAML::Node, LogDefine>()(YAML::Load(v));
+        }
+    };
+
+    /**
+     * LogDefine -> YAML::Node
+     */
+    template <>
+    class LexicalCast<LogDefine, YAML::Node>
+    {
+    public:
+        YAML::Node operator()(const LogDefine &i)
         {
             // 将LogDefine对象中的值依次设置到YAML::Node中
             YAML::Node n;
@@ -160,6 +223,15 @@ namespace sylar
             {
                 n["formatter"] = i.formatter;
             }
+            if (i.rate)
+            {
+                n["rate"] = i.rate;
+                n["burst"] = i.burst;
+            }
+            if (i.sample > 1)
+            {
+                n["sample"] = i.sample;
+            }
 
             for (auto &a : i.appenders)
             {
@@ -174,6 +246,16 @@ namespace sylar
                 {
                     na["type"] = "StdoutLogAppender";
                 }
+                else if (a.type == 3)
+                {
+                    na["type"] = "BinaryLogAppender";
+                    na["file"] = a.file;
+                }
+                else if (a.type == 4)
+                {
+                    na["type"] = "ShmLogAppender";
+                    na["file"] = a.file;
+                }
                 // 每个单独的appender也要单独设置level和formatter
                 if (a.level != LogLevel::UNKNOW)
                 {
@@ -187,8 +269,21 @@ namespace sylar
 
                 n["appenders"].push_back(na);
             }
+            return n;
+        }
+    };
+
+    /**
+     * LogDefine -> string
+     */
+    template <>
+    class LexicalCast<LogDefine, std::string>
+    {
+    public:
+        std::string operator()(const LogDefine &i)
+        {
             std::stringstream ss;
-            ss << n;
+            ss << LexicalCast<LogDefine, YAML::Node>()(i);
             return ss.str();
         }
     };
@@ -229,14 +324,29 @@ namespace sylar
                                                }
                                                // 对于新增的值，要设置日志级别
                                                logger->setLevel(i.level);
-                                               if(!i.formatter.empty()){
+                                               if(!i.formatter.empty() && (it == old_value.end() || it->formatter != i.formatter)){
                                                 logger->setFormatter(i.formatter);
                                                }
-                                                // 清空appender
-                                               logger->clearAppenders();
+                                               logger->setLimit(i.rate, i.burst, i.sample);
 
+                                               // 上次按配置创建的appender,定义没变的直接复用,不重新打开文件
+                                               Logger::AppenderListPtr old_aps = logger->getAppenders();
+                                               bool can_reuse = it != old_value.end() && old_aps->size() == it->appenders.size();
+                                               std::vector<bool> used(old_aps->size(), false);
+                                               Logger::AppenderList aps;
                                                for(auto& a:i.appenders){
                                                 sylar::LogAppender::ptr ap;
+                                                for(size_t k = 0; can_reuse && k < it->appenders.size(); ++k){
+                                                    if(!used[k] && it->appenders[k] == a){
+                                                        used[k] = true;
+                                                        ap = (*old_aps)[k];
+                                                        break;
+                                                    }
+                                                }
+                                                if(ap){
+                                                    aps.push_back(ap);
+                                                    continue;
+                                                }
                                                 if(a.type==1){
                                                     ap.reset(new FileLogAppender(a.file));
                                                 }else if(a.type==2){
@@ -246,6 +356,12 @@ namespace sylar
                                                     // } else {
                                                         // continue;
                                                     // }
+                                                }else if(a.type==3){
+                                                    ap.reset(new BinaryLogAppender(a.file));
+                                                }else if(a.type==4){
+                                                    ap.reset(new ShmLogAppender(a.file));
+                                                }else{
+                                                    continue;
                                                 }
                                                 ap->setLevel(a.level);
                                                 if(!a.formatter.empty()){
@@ -257,8 +373,10 @@ namespace sylar
                                       << " formatter=" << a.formatter << " is invalid" << std::endl;
                                                     }
                                                 }
-                                                logger->addAppender(ap);
+                                                aps.push_back(ap);
                                                }
+                                               // 一次性替换,替换期间的日志不会丢失
+                                               logger->setAppenders(aps);
                                            }
 
                                            // 删除
@@ -272,6 +390,7 @@ namespace sylar
                                                    // 可以将日志关闭，或者日志级别设定很高，这样就不会真的触发写日志了
                                                    auto logger = SYLAR_LOG_NAME(i.name);
                                                    logger->setLevel((LogLevel::Level)100);
+                                                   logger->setLimit(0, 0, 0);
                                                    logger->clearAppenders();
                                                }
                                            } });
@@ -0,0 +1,263 @@
+#include "log_shm.h"
+#include "config.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+
+namespace sylar
+{
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
+    // 跨进程使用,不能带FUTEX_PRIVATE_FLAG
+    static int FutexWait(std::atomic<uint32_t> *addr, uint32_t val, const struct timespec *ts)
+    {
+        return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAIT, val, ts, nullptr, 0);
+    }
+
+    static int FutexWake(std::atomic<uint32_t> *addr, int n)
+    {
+        return syscall(SYS_futex, (uint32_t *)addr, FUTEX_WAKE, n, nullptr, nullptr, 0);
+    }
+
+    // 记录长度按8字节对齐
+    static uint64_t RecordSize(uint32_t len)
+    {
+        return (sizeof(uint32_t) + (uint64_t)len + 7) & ~(uint64_t)7;
+    }
+
+    /**
+     * ShmLogRing类的方法实现
+     */
+    ShmLogRing::ptr ShmLogRing::Open(const std::string &name, uint32_t capacity)
+    {
+        uint32_t cap = 4096;
+        while (cap < capacity && cap < (1u << 31))
+        {
+            cap <<= 1;
+        }
+
+        bool create = true;
+        int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0 && errno == EEXIST)
+        {
+            create = false;
+            fd = shm_open(name.c_str(), O_RDWR, 0644);
+        }
+        if (fd < 0)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "shm_open " << name << " failed errno=" << errno << " " << strerror(errno);
+            return nullptr;
+        }
+
+        size_t size = 0;
+        if (create)
+        {
+            size = sizeof(Header) + cap;
+            if (ftruncate(fd, size) < 0)
+            {
+                SYLAR_LOG_ERROR(g_logger) << "ftruncate " << name << " failed errno=" << errno << " " << strerror(errno);
+                close(fd);
+                shm_unlink(name.c_str());
+                return nullptr;
+            }
+        }
+        else
+        {
+            // 创建者可能还没有设置大小,稍等片刻
+            struct stat st;
+            for (int i = 0; i < 100; ++i)
+            {
+                if (fstat(fd, &st) == 0 && (size_t)st.st_size > sizeof(Header))
+                {
+                    size = st.st_size;
+                    break;
+                }
+                usleep(10 * 1000);
+            }
+            if (size == 0)
+            {
+                SYLAR_LOG_ERROR(g_logger) << "shm " << name << " is not initialized";
+                close(fd);
+                return nullptr;
+            }
+        }
+
+        void *addr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (addr == MAP_FAILED)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "mmap " << name << " failed errno=" << errno << " " << strerror(errno);
+            return nullptr;
+        }
+
+        Header *header = (Header *)addr;
+        if (create)
+        {
+            // ftruncate出来的内存全为0,只需设置容量,最后写magic表示初始化完成
+            header->capacity = cap;
+            header->magic.store(MAGIC, std::memory_order_release);
+        }
+        else
+        {
+            for (int i = 0; i < 100 && header->magic.load(std::memory_order_acquire) != MAGIC; ++i)
+            {
+                usleep(10 * 1000);
+            }
+            if (header->magic.load(std::memory_order_acquire) != MAGIC ||
+                sizeof(Header) + header->capacity != size)
+            {
+                SYLAR_LOG_ERROR(g_logger) << "shm " << name << " is not a log ring";
+                munmap(addr, size);
+                return nullptr;
+            }
+        }
+        return ShmLogRing::ptr(new ShmLogRing(name, header, size));
+    }
+
+    void ShmLogRing::Unlink(const std::string &name)
+    {
+        shm_unlink(name.c_str());
+    }
+
+    ShmLogRing::ShmLogRing(const std::string &name, Header *header, size_t size)
+        : m_name(name),
+          m_header(header),
+          m_data((char *)header + sizeof(Header)),
+          m_size(size)
+    {
+    }
+
+    ShmLogRing::~ShmLogRing()
+    {
+        munmap(m_header, m_size);
+    }
+
+    bool ShmLogRing::write(const char *data, uint32_t len)
+    {
+        uint64_t cap = m_header->capacity;
+        uint64_t need = RecordSize(len);
+        uint64_t w = m_header->writePos.load(std::memory_order_relaxed);
+        uint64_t r = m_header->readPos.load(std::memory_order_acquire);
+        uint64_t idx = w & (cap - 1);
+        uint64_t tail = cap - idx;
+        // 尾部放不下,跳过尾部从头开始
+        uint64_t pad = need > tail ? tail : 0;
+        if (need > cap / 2 || w + pad + need - r > cap)
+        {
+            m_header->dropped.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        if (pad)
+        {
+            uint32_t wrap = WRAP;
+            memcpy(m_data + idx, &wrap, sizeof(wrap));
+            w += pad;
+            idx = 0;
+        }
+        memcpy(m_data + idx, &len, sizeof(len));
+        memcpy(m_data + idx + sizeof(len), data, len);
+        m_header->writePos.store(w + need, std::memory_order_release);
+
+        // 与读进程设置waiting后检查writePos配对,保证不会丢失唤醒
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_header->waiting.load(std::memory_order_relaxed))
+        {
+            m_header->futex.fetch_add(1, std::memory_order_release);
+            FutexWake(&m_header->futex, INT_MAX);
+        }
+        return true;
+    }
+
+    bool ShmLogRing::read(std::string &out, int timeout_ms)
+    {
+        uint64_t cap = m_header->capacity;
+        while (true)
+        {
+            uint64_t r = m_header->readPos.load(std::memory_order_relaxed);
+            uint64_t w = m_header->writePos.load(std::memory_order_acquire);
+            if (r != w)
+            {
+                uint64_t idx = r & (cap - 1);
+                uint32_t len = 0;
+                memcpy(&len, m_data + idx, sizeof(len));
+                if (len == WRAP)
+                {
+                    m_header->readPos.store(r + cap - idx, std::memory_order_release);
+                    continue;
+                }
+                out.assign(m_data + idx + sizeof(len), len);
+                m_header->readPos.store(r + RecordSize(len), std::memory_order_release);
+                return true;
+            }
+            if (timeout_ms == 0)
+            {
+                return false;
+            }
+
+            // 缓冲区为空,先声明要睡眠再检查一次,之后才真正等待
+            uint32_t seq = m_header->futex.load(std::memory_order_acquire);
+            m_header->waiting.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_header->writePos.load(std::memory_order_relaxed) == r)
+            {
+                struct timespec ts;
+                ts.tv_sec = timeout_ms / 1000;
+                ts.tv_nsec = (long)(timeout_ms % 1000) * 1000 * 1000;
+                if (FutexWait(&m_header->futex, seq, timeout_ms < 0 ? nullptr : &ts) < 0 && errno == ETIMEDOUT)
+                {
+                    // 超时后再检查一次就返回
+                    timeout_ms = 0;
+                }
+            }
+            m_header->waiting.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    /**
+     * ShmLogAppender类的方法实现
+     */
+    ShmLogAppender::ShmLogAppender(const std::string &name, uint32_t capacity)
+        : m_name(name),
+          m_ring(ShmLogRing::Open(name, capacity))
+    {
+    }
+
+    void ShmLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
+    {
+        if (level >= m_level && m_ring)
+        {
+            LogFormatter::ptr formatter;
+            {
+                MutexType::Lock lock(m_mutex);
+                formatter = m_formatter;
+            }
+            // 格式化不需要持有锁
+            std::string str = formatter->format(logger, level, event);
+            MutexType::Lock lock(m_mutex);
+            m_ring->write(str.data(), str.size());
+        }
+    }
+
+    std::string ShmLogAppender::toYamlString()
+    {
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "ShmLogAppender";
+        node["file"] = m_name;
+        if (m_level != LogLevel::UNKNOW)
+        {
+            node["level"] = LogLevel::ToString(m_level);
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef __SYLAR_LOG_SHM_H__
+#define __SYLAR_LOG_SHM_H__
+
+#include "log.h"
+#include <atomic>
+
+/**
+ * 共享内存日志
+ * 日志进程把格式化好的日志写入POSIX共享内存中的环形缓冲区,其他进程映射同一块内存读取
+ * 写日志不需要系统调用,只有读进程因为缓冲区为空而睡眠时才用futex唤醒一次
+ *
+ * 共享内存布局: ShmLogRing::Header + capacity字节的数据区
+ * 每条记录: len(u32) + 内容, 按8字节对齐; 数据区尾部放不下时写入回绕标记, 从头开始写
+ * 读写位置单调递增, 取模得到下标, 写进程之间由appender的锁串行(单写单读)
+ */
+
+namespace sylar
+{
+    /**
+     * 共享内存环形缓冲区
+     */
+    class ShmLogRing
+    {
+    public:
+        typedef std::shared_ptr<ShmLogRing> ptr;
+
+        static const uint32_t MAGIC = 0x534c5247; // "SLRG"
+        static const uint32_t WRAP = 0xffffffff;  // 回绕标记
+
+        /**
+         * 共享内存头部,读写位置分别独占缓存行,避免伪共享
+         */
+        struct Header
+        {
+            std::atomic<uint32_t> magic;
+            uint32_t capacity;                         // 数据区大小,2的整数次幂
+            alignas(64) std::atomic<uint64_t> writePos; // 写位置,只由写进程修改
+            std::atomic<uint64_t> dropped;             // 缓冲区满丢弃的日志条数
+            alignas(64) std::atomic<uint64_t> readPos;  // 读位置,只由读进程修改
+            alignas(64) std::atomic<uint32_t> futex;    // 唤醒计数,futex等待的地址
+            std::atomic<uint32_t> waiting;             // 读进程是否在睡眠
+        };
+
+        /**
+         * @brief 打开名为name的共享内存,不存在则创建
+         * @param capacity 创建时数据区的大小,向上取整为2的整数次幂
+         * @return 失败返回nullptr
+         */
+        static ShmLogRing::ptr Open(const std::string &name, uint32_t capacity = 4 * 1024 * 1024);
+
+        /**
+         * 删除共享内存对象,已经映射的进程不受影响
+         */
+        static void Unlink(const std::string &name);
+
+        ~ShmLogRing();
+
+        /**
+         * @brief 写入一条日志,缓冲区满时丢弃并计数
+         * @return 写入成功返回true
+         */
+        bool write(const char *data, uint32_t len);
+
+        /**
+         * @brief 读取一条日志,缓冲区为空时最多等待timeout_ms毫秒
+         * @param timeout_ms 小于0表示一直等待
+         * @return 读到日志返回true
+         */
+        bool read(std::string &out, int timeout_ms = -1);
+
+        /**
+         * 返回因为缓冲区满丢弃的日志条数
+         */
+        uint64_t getDropped() const { return m_header->dropped.load(std::memory_order_relaxed); }
+
+        uint32_t getCapacity() const { return m_header->capacity; }
+
+        const std::string &getName() const { return m_name; }
+
+    private:
+        ShmLogRing(const std::string &name, Header *header, size_t size);
+
+    private:
+        std::string m_name; // 共享内存名称
+        Header *m_header;   // 映射的头部
+        char *m_data;       // 映射的数据区
+        size_t m_size;      // 映射的总大小
+    };
+
+    /**
+     * 输出到共享内存,由其他进程使用ShmLogRing读取
+     */
+    class ShmLogAppender : public LogAppender
+    {
+    public:
+        typedef std::shared_ptr<ShmLogAppender> ptr;
+
+        /**
+         * @param name 共享内存名称,如"/sylar_log"
+         * @param capacity 数据区大小
+         */
+        ShmLogAppender(const std::string &name, uint32_t capacity = 4 * 1024 * 1024);
+
+        void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
+
+        std::string toYamlString() override;
+
+        /**
+         * 返回共享内存,打开失败时为nullptr
+         */
+        ShmLogRing::ptr getRing() const { return m_ring; }
+
+    private:
+        std::string m_name;     // 共享内存名称
+        ShmLogRing::ptr m_ring; // 环形缓冲区
+    };
+}
+
+#endif
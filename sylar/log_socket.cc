@@ -1,13 +1,48 @@
 #include "log_socket.h"
+#include "config.h"
+#include <sys/uio.h>
+#include <fcntl.h>
+#include <algorithm>
 
 namespace sylar
 {
+    static sylar::Logger::ptr g_logger = SYLAR_LOG_NAME("system");
+
     // static SocketLogAppender *t_socketlog; // 存放日志套接字的指针
     SocketLogAppender *SocketLogAppender::t_socketlog = nullptr;
 
-    SocketLogAppender::SocketLogAppender(char *socket_local_path)
+    // 一次sendmsg最多发送的日志条数
+    static const size_t MAX_IOV = 64;
+
+    SocketLogAppender::SocketLogAppender(const std::string &socket_local_path,
+                                         size_t max_queue_bytes,
+                                         OverflowPolicy policy)
+        : m_socket_local_path(socket_local_path),
+          m_maxQueueBytes(max_queue_bytes),
+          m_policy(policy)
     {
-        m_socket_local_path = socket_local_path;
+    }
+
+    SocketLogAppender::~SocketLogAppender()
+    {
+        if (listenfd >= 0)
+        {
+            if (m_iom)
+            {
+                // 触发accept回调,回调中持有的是weak_ptr,不会再注册
+                m_iom->cancelAll(listenfd);
+            }
+            close(listenfd);
+        }
+        // 发送中的客户端会持有this,走到这里说明已经没有注册的事件
+        for (auto &i : m_clients)
+        {
+            close(i->fd);
+        }
+        if (t_socketlog == this)
+        {
+            t_socketlog = nullptr;
+        }
     }
 
     void SocketLogAppender::SetThis(SocketLogAppender *s)
@@ -17,79 +52,355 @@ namespace sylar
 
     SocketLogAppender::ptr SocketLogAppender::GetThis()
     {
-        return SocketLogAppender::ptr(t_socketlog);
+        return t_socketlog ? t_socketlog->shared_from_this() : nullptr;
     }
 
-    void SocketLogAppender::init()
+    bool SocketLogAppender::init(IOManager *iom)
     {
-        listenfd = socket(AF_LOCAL, SOCK_STREAM, 0);
+        if (m_socket_local_path.size() >= sizeof(((sockaddr_un *)0)->sun_path))
+        {
+            SYLAR_LOG_ERROR(g_logger) << "log socket path too long: " << m_socket_local_path;
+            return false;
+        }
+        listenfd = socket(AF_LOCAL, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
         if (listenfd < 0)
         {
-            std::cout << "socket create failed" << std::endl;
-            return;
+            SYLAR_LOG_ERROR(g_logger) << "log socket create failed errno=" << errno << " " << strerror(errno);
+            return false;
         }
         // 将本地文件删除
-        unlink(m_socket_local_path);
+        unlink(m_socket_local_path.c_str());
+        struct sockaddr_un servaddr;
         bzero(&servaddr, sizeof(servaddr));
         servaddr.sun_family = AF_LOCAL;
-        strcpy(servaddr.sun_path, m_socket_local_path);
+        strcpy(servaddr.sun_path, m_socket_local_path.c_str());
 
-        // 绑定
-        if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0)
+        // 绑定 & 监听
+        if (bind(listenfd, (struct sockaddr *)&servaddr, sizeof(servaddr)) < 0 ||
+            listen(listenfd, LISTENQ) < 0)
+        {
+            SYLAR_LOG_ERROR(g_logger) << "log socket bind/listen " << m_socket_local_path
+                                      << " failed errno=" << errno << " " << strerror(errno);
+            close(listenfd);
+            listenfd = -1;
+            return false;
+        }
+
+        m_iom = iom;
+        SetThis(this);
+        // 注册事件必须在IOManager的线程中进行
+        std::weak_ptr<SocketLogAppender> weak_self = shared_from_this();
+        m_iom->schedule([weak_self]()
+                        {
+            auto self = weak_self.lock();
+            if (self)
+            {
+                self->onAccept();
+            } });
+        return true;
+    }
+
+    void SocketLogAppender::onAccept()
+    {
+        while (true)
+        {
+            int fd = accept4(listenfd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                // EAGAIN: 已经没有等待中的连接
+                break;
+            }
+            Client::ptr client(new Client);
+            client->fd = fd;
+            MutexType::Lock lock(m_mutex);
+            m_clients.push_back(client);
+        }
+        // 事件触发后已被移除,需要重新注册
+        std::weak_ptr<SocketLogAppender> weak_self = shared_from_this();
+        if (m_iom->addEvent(listenfd, IOManager::READ, [weak_self]()
+                            {
+            auto self = weak_self.lock();
+            if (self)
+            {
+                self->onAccept();
+            } }))
+        {
+            // 不能再接收新的订阅者,关闭监听套接字,已连接的订阅者不受影响
+            SYLAR_LOG_ERROR(g_logger) << "log socket " << m_socket_local_path << " register accept failed";
+            close(listenfd);
+            listenfd = -1;
+        }
+    }
+
+    void SocketLogAppender::closeClient(Client::ptr client)
+    {
+        client->closed = true;
+        if (client->released)
         {
-            std::cout << "bind failed" << std::endl;
             return;
         }
+        client->released = true;
+        auto it = std::find(m_clients.begin(), m_clients.end(), client);
+        if (it != m_clients.end())
+        {
+            m_clients.erase(it);
+        }
+        client->queue.clear();
+        client->queuedBytes = 0;
+        if (client->pins == 0)
+        {
+            close(client->fd);
+            client->fd = -1;
+        }
+    }
 
-        // 监听
-        if (listen(listenfd, LISTENQ) < 0)
+    void SocketLogAppender::kickClient(Client::ptr client)
+    {
+        // pins大于0期间fd不会被关闭,也就不会被复用给其他连接
+        // 在锁外取消:IOManager可能写日志到本appender,持锁调用会重入m_mutex死锁
+        m_iom->cancelEvent(client->fd, IOManager::WRITE);
+        MutexType::Lock lock(m_mutex);
+        if (--client->pins == 0 && client->released && client->fd >= 0)
         {
-            std::cout << "listen failed" << std::endl;
-            // error(1, errno, "listen failed");
+            // 期间已经断开,由最后一个使用者关闭
+            close(client->fd);
+            client->fd = -1;
         }
+    }
 
-        socklen_t clilen = sizeof(clientaddr);
-        std::cout << "open log socket service" << std::endl;
-        // 接收客户端连接
-        if ((connfd = accept(listenfd, (struct sockaddr *)&clientaddr, &clilen)) < 0)
+    void SocketLogAppender::flush(Client::ptr client)
+    {
+        std::vector<std::shared_ptr<const std::string>> batch;
+        struct iovec iov[MAX_IOV];
+        while (true)
         {
-            std::cout << "accept failed" << std::endl;
+            size_t offset = 0;
+            {
+                MutexType::Lock lock(m_mutex);
+                if (client->closed)
+                {
+                    // log()中被标记为断开的慢客户端,在这里真正关闭
+                    closeClient(client);
+                    return;
+                }
+                if (client->dropped && client->offset == 0)
+                {
+                    // 告知订阅者中间有日志被丢弃
+                    std::shared_ptr<const std::string> tip(new std::string(
+                        "[log stream lagged, " + std::to_string(client->dropped) + " lines dropped]\n"));
+                    client->queue.push_front(tip);
+                    client->queuedBytes += tip->size();
+                    client->dropped = 0;
+                }
+                if (client->queue.empty())
+                {
+                    client->flushing = false;
+                    return;
+                }
+                // 取出一批日志,发送时不持有锁
+                offset = client->offset;
+                client->offset = 0;
+                batch.clear();
+                while (!client->queue.empty() && batch.size() < MAX_IOV)
+                {
+                    batch.push_back(client->queue.front());
+                    client->queue.pop_front();
+                }
+            }
+
+            for (size_t i = 0; i < batch.size(); ++i)
+            {
+                iov[i].iov_base = (void *)(batch[i]->data() + (i == 0 ? offset : 0));
+                iov[i].iov_len = batch[i]->size() - (i == 0 ? offset : 0);
+            }
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = iov;
+            msg.msg_iovlen = batch.size();
+            // 与writev相同的批量发送,MSG_NOSIGNAL避免对端关闭时触发SIGPIPE
+            ssize_t n = sendmsg(client->fd, &msg, MSG_NOSIGNAL);
+            int err = n < 0 ? errno : 0;
+            if (n < 0 && err != EAGAIN && err != EINTR)
+            {
+                MutexType::Lock lock(m_mutex);
+                closeClient(client);
+                return;
+            }
+
+            // 计算发送了多少条,未发送的放回队首
+            size_t sent = n > 0 ? n : 0;
+            size_t done = 0;
+            size_t left_offset = offset;
+            while (done < batch.size())
+            {
+                size_t len = batch[done]->size() - left_offset;
+                if (sent < len)
+                {
+                    left_offset += sent;
+                    break;
+                }
+                sent -= len;
+                left_offset = 0;
+                ++done;
+            }
+
+            bool all_sent = done == batch.size();
+            {
+                MutexType::Lock lock(m_mutex);
+                for (size_t i = 0; i < done; ++i)
+                {
+                    client->queuedBytes -= std::min(client->queuedBytes, batch[i]->size());
+                }
+                for (size_t i = batch.size(); i > done; --i)
+                {
+                    client->queue.push_front(batch[i - 1]);
+                }
+                client->offset = all_sent ? 0 : left_offset;
+            }
+            batch.clear();
+
+            if (all_sent || err == EINTR)
+            {
+                continue;
+            }
+
+            // 发送缓冲区已满,等待可写后继续
+            if (m_iom->addEvent(client->fd, IOManager::WRITE,
+                                std::bind(&SocketLogAppender::flush, shared_from_this(), client)))
+            {
+                MutexType::Lock lock(m_mutex);
+                closeClient(client);
+                return;
+            }
+            bool kick = false;
+            {
+                MutexType::Lock lock(m_mutex);
+                if (client->closed && !client->released)
+                {
+                    ++client->pins;
+                    kick = true;
+                }
+            }
+            if (kick)
+            {
+                // 注册期间被标记为断开,主动触发一次,由回调关闭
+                kickClient(client);
+            }
             return;
         }
-        is_connect = true; // 已经有客户端连接
-        std::cout << "已经有客户端连接" << std::endl;
-        SetThis(this);
     }
 
     void SocketLogAppender::log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event)
     {
-        if (!is_connect)
-        {
-            std::cout << "no client connect!\n";
-        }
-        std::cout << "enter log sock func" << std::endl;
-        if (level >= m_level)
-        {
-            // MutexType::Lock lock(m_mutex);
-            // 按照指定格式进行格式化
-            // 清空缓冲区
-            send_line.str("");
-            // 将日志消息读入stringstream
-            send_line << m_formatter->format(logger, level, event);
-            int nbytes = send_line.str().length();
-            // 发送消息
-            if (write(connfd, send_line.str().c_str(), nbytes) != nbytes)
+        if (level < m_level || !m_iom)
+        {
+            return;
+        }
+        LogFormatter::ptr formatter;
+        {
+            MutexType::Lock lock(m_mutex);
+            if (m_clients.empty())
             {
-                std::cout << "usage: unixstreamserver <local_path>" << std::endl;
+                // 没有订阅者,不需要格式化
                 return;
             }
+            formatter = m_formatter;
+        }
+        std::shared_ptr<const std::string> line(new std::string(formatter->format(logger, level, event)));
+
+        std::vector<Client::ptr> to_schedule;
+        std::vector<Client::ptr> to_kick;
+        {
+            MutexType::Lock lock(m_mutex);
+            for (auto &client : m_clients)
+            {
+                if (client->closed)
+                {
+                    continue;
+                }
+                if (client->queuedBytes + line->size() > m_maxQueueBytes)
+                {
+                    if (m_policy == DROP_CLIENT)
+                    {
+                        // 慢客户端,由IOManager线程断开
+                        client->closed = true;
+                        if (client->flushing)
+                        {
+                            // 取消事件前fd不会被关闭
+                            ++client->pins;
+                            to_kick.push_back(client);
+                        }
+                        else
+                        {
+                            client->flushing = true;
+                            to_schedule.push_back(client);
+                        }
+                        continue;
+                    }
+                    // 丢弃最旧的日志(正在发送的队首保留)
+                    while (client->queue.size() > (client->offset ? 1 : 0) &&
+                           client->queuedBytes + line->size() > m_maxQueueBytes)
+                    {
+                        auto it = client->offset ? client->queue.begin() + 1 : client->queue.begin();
+                        client->queuedBytes -= std::min(client->queuedBytes, (*it)->size());
+                        client->queue.erase(it);
+                        ++client->dropped;
+                    }
+                    if (client->queuedBytes + line->size() > m_maxQueueBytes)
+                    {
+                        ++client->dropped;
+                        continue;
+                    }
+                }
+                client->queue.push_back(line);
+                client->queuedBytes += line->size();
+                if (!client->flushing)
+                {
+                    client->flushing = true;
+                    to_schedule.push_back(client);
+                }
+            }
+        }
+
+        // 在IOManager上发送,写日志的线程不做任何IO
+        for (auto &client : to_schedule)
+        {
+            m_iom->schedule(std::bind(&SocketLogAppender::flush, shared_from_this(), client));
+        }
+        // 正在等待写事件的,取消事件让回调去关闭;返回false说明发送任务已在队列中
+        for (auto &client : to_kick)
+        {
+            kickClient(client);
         }
     }
 
+    size_t SocketLogAppender::getClientCount()
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_clients.size();
+    }
+
     std::string SocketLogAppender::toYamlString()
     {
-        std::cout<<"zje"<<std::endl;
-        return "";
+        MutexType::Lock lock(m_mutex);
+        YAML::Node node;
+        node["type"] = "SocketLogAppender";
+        node["path"] = m_socket_local_path;
+        if (m_level != LogLevel::UNKNOW)
+        {
+            node["level"] = LogLevel::ToString(m_level);
+        }
+        if (m_hasFormatter && m_formatter)
+        {
+            node["formatter"] = m_formatter->getPattern();
+        }
+        std::stringstream ss;
+        ss << node;
+        return ss.str();
     }
 
-}
\ No newline at end of file
+}
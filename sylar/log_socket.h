@@ -2,11 +2,14 @@
 #define __SYLAR_LOG_SOCKET_H__
 
 #include "log.h"
+#include "iomanager.h"
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
 #include <sys/un.h>
 #include <string.h>
+#include <deque>
+#include <list>
 
 #define MAXLINE 4096
 #define LISTENQ 1024
@@ -14,7 +17,11 @@
 
 namespace sylar
 {
-    // 通过socket输入其他进程,使用本地套接字实现
+    /**
+     * 通过socket输入其他进程,使用本地套接字实现
+     * 监听套接字和所有订阅者连接都是非阻塞的,由IOManager负责accept和发送
+     * 写日志的线程只把文本放入每个订阅者的发送队列,不会阻塞在慢客户端上
+     */
     class SocketLogAppender : public LogAppender, public std::enable_shared_from_this<SocketLogAppender>
     {
     public:
@@ -23,27 +30,40 @@ namespace sylar
     public:
         typedef std::shared_ptr<SocketLogAppender> ptr;
 
-        SocketLogAppender()
+        /**
+         * 发送队列满时的处理策略
+         */
+        enum OverflowPolicy
         {
-        }
+            DROP_CLIENT = 0, // 断开慢客户端
+            DROP_OLDEST = 1, // 丢弃最旧的日志,客户端落后但保持连接
+        };
+
+        /**
+         * @param socket_local_path 监听本地套接字文件
+         * @param max_queue_bytes 每个订阅者发送队列的最大字节数
+         * @param policy 发送队列满时的处理策略
+         */
+        SocketLogAppender(const std::string &socket_local_path,
+                          size_t max_queue_bytes = 1024 * 1024,
+                          OverflowPolicy policy = DROP_OLDEST);
 
-        SocketLogAppender(char *socket_local_path);
         virtual void log(std::shared_ptr<Logger> logger, LogLevel::Level level, LogEvent::ptr event) override;
 
         /**
-         * @brief 初始化套接字
-         *
+         * @brief 初始化套接字,在iom上接收订阅者连接
+         * @return 监听成功返回true
          */
-        void init();
+        bool init(IOManager *iom);
 
         std::string toYamlString() override;
 
-        ~SocketLogAppender()
-        {
-            // 关闭连接
-            close(connfd);
-            close(listenfd);
-        }
+        /**
+         * 返回当前订阅者数量
+         */
+        size_t getClientCount();
+
+        ~SocketLogAppender();
 
     public:
         static void SetThis(SocketLogAppender *s);
@@ -51,16 +71,53 @@ namespace sylar
         static SocketLogAppender::ptr GetThis();
 
     private:
-        int listenfd;                  // 监听套接字
-        int connfd;                    // 连接套接字
-        struct sockaddr_un servaddr;   // 服务端套接字结构体
-        struct sockaddr_un clientaddr; // 客服端套接字结构体
-        char *m_socket_local_path;     // 监听本地套接字文件 socket_local_file
-
-        // 日志内容,调用format会返回一个字符串，将该字符串发给线程
-        std::stringstream send_line; // 发送缓冲区
-        bool is_connect = false;     // 是否已经有客户端连接
+        /**
+         * 订阅者连接
+         */
+        struct Client
+        {
+            typedef std::shared_ptr<Client> ptr;
+            int fd = -1;
+            std::deque<std::shared_ptr<const std::string>> queue; // 待发送的日志,多个订阅者共享同一份文本
+            size_t queuedBytes = 0;        // 队列中的字节数
+            size_t offset = 0;             // 队首日志已发送的字节数
+            uint64_t dropped = 0;          // 因为队列满丢弃的日志条数
+            bool flushing = false;         // 是否已经安排了发送
+            bool closed = false;           // 是否已经断开
+            bool released = false;         // closeClient已执行,fd在pins归零后关闭
+            int pins = 0;                  // 锁外正在使用fd(取消写事件)的次数,大于0时推迟close,避免fd被复用
+        };
+
+        /**
+         * 接收所有等待中的连接,并重新注册读事件
+         */
+        void onAccept();
+
+        /**
+         * 在IOManager上批量发送client的队列,发送不完时等待写事件
+         */
+        void flush(Client::ptr client);
+
+        /**
+         * 断开client,调用时需持有m_mutex
+         * 有其他线程在锁外使用fd时推迟到unpinClient中关闭
+         */
+        void closeClient(Client::ptr client);
+
+        /**
+         * 在锁外取消client的写事件,让等待中的发送回调去关闭它
+         * 调用前需在持有m_mutex时把client->pins加1,期间fd不会被关闭
+         */
+        void kickClient(Client::ptr client);
+
+    private:
+        int listenfd = -1;                 // 监听套接字
+        std::string m_socket_local_path;   // 监听本地套接字文件 socket_local_file
+        size_t m_maxQueueBytes;            // 每个订阅者发送队列的最大字节数
+        OverflowPolicy m_policy;           // 发送队列满时的处理策略
+        IOManager *m_iom = nullptr;        // 负责accept和发送的IO调度器
+        std::list<Client::ptr> m_clients;  // 订阅者
     };
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,5 +1,14 @@
 #include <stdexcept>
 #include "mutex.h"
+#include <time.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <map>
+#include <vector>
+#include <algorithm>
+#include <sstream>
 
 namespace sylar
 {
@@ -34,4 +43,580 @@ namespace sylar
         }
     }
 
-}
\ No newline at end of file
+
+    static uint64_t MonotonicNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+    }
+
+    void AdaptiveMutex::lockSlow()
+    {
+        m_contended.fetch_add(1, std::memory_order_relaxed);
+        uint64_t start = MonotonicNs();
+
+        // 先自旋,持有者通常很快释放;只在锁看起来空闲时才CAS,避免抢占缓存行
+        int pause = 1;
+        for (int round = 0; round < SPIN_ROUNDS; ++round)
+        {
+            for (int i = 0; i < pause; ++i)
+            {
+                CpuRelax();
+            }
+            if (pause < SPIN_MAX_PAUSE)
+            {
+                pause <<= 1;
+            }
+            uint32_t c = m_state.load(std::memory_order_relaxed);
+            if (c == UNLOCKED &&
+                m_state.compare_exchange_weak(c, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                m_waitNs.fetch_add(MonotonicNs() - start, std::memory_order_relaxed);
+                return;
+            }
+        }
+
+        // 标记为有等待者后睡眠;被唤醒后仍以PARKED状态持有锁,保证解锁时唤醒其余的等待者
+        m_parked.fetch_add(1, std::memory_order_relaxed);
+        while (m_state.exchange(PARKED, std::memory_order_acquire) != UNLOCKED)
+        {
+            syscall(SYS_futex, (uint32_t *)&m_state, FUTEX_WAIT_PRIVATE, PARKED, nullptr, nullptr, 0);
+        }
+        m_waitNs.fetch_add(MonotonicNs() - start, std::memory_order_relaxed);
+    }
+
+    void AdaptiveMutex::wake()
+    {
+        syscall(SYS_futex, (uint32_t *)&m_state, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+    }
+
+    AdaptiveMutex::Stats AdaptiveMutex::getStats() const
+    {
+        Stats stats;
+        stats.acquisitions = m_acquisitions.load(std::memory_order_relaxed);
+        stats.contended = m_contended.load(std::memory_order_relaxed);
+        stats.parked = m_parked.load(std::memory_order_relaxed);
+        stats.waitNs = m_waitNs.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    void AdaptiveMutex::resetStats()
+    {
+        m_acquisitions.store(0, std::memory_order_relaxed);
+        m_contended.store(0, std::memory_order_relaxed);
+        m_parked.store(0, std::memory_order_relaxed);
+        m_waitNs.store(0, std::memory_order_relaxed);
+    }
+
+    // 先自旋,仍未满足条件则让出CPU
+    template <class Pred>
+    static void SpinWait(Pred pred)
+    {
+        for (int i = 0; !pred(); ++i)
+        {
+            if (i < 1000)
+            {
+                CpuRelax();
+            }
+            else
+            {
+                sched_yield();
+            }
+        }
+    }
+
+    void BrRWMutex::rdlockSlow(std::atomic<int64_t> &count)
+    {
+        while (true)
+        {
+            // 写优先: 有写者时先退出,等写者完成后重试
+            count.fetch_sub(1, std::memory_order_release);
+            SpinWait([this]()
+                     { return !m_writer.load(std::memory_order_acquire); });
+            count.fetch_add(1, std::memory_order_seq_cst);
+            if (!m_writer.load(std::memory_order_seq_cst))
+            {
+                return;
+            }
+        }
+    }
+
+    void BrRWMutex::wrlock()
+    {
+        pthread_mutex_lock(&m_wmutex);
+        m_writer.store(true, std::memory_order_seq_cst);
+        // 等待已经持有读锁的读者全部退出
+        SpinWait([this]()
+                 {
+            int64_t sum = 0;
+            for (auto &i : m_slots)
+            {
+                sum += i.count.load(std::memory_order_acquire);
+            }
+            return sum == 0; });
+        m_owner.store(ThreadToken(), std::memory_order_relaxed);
+    }
+
+    /**
+     * 线程的RCU状态,只由所属线程写
+     */
+    struct RcuThread
+    {
+        std::atomic<uint64_t> epoch{0}; // 进入读临界区时的全局epoch,0表示不在读临界区
+        int nesting = 0;                // 嵌套层数
+    };
+
+    static void RcuThreadExit(RcuThread *t);
+
+    /**
+     * 线程退出时执行剩余的待释放回调并释放线程的RCU状态
+     * 只在线程第一次进入读临界区或Retire时访问,读临界区的快速路径不经过thread_local的初始化检查
+     * 主线程的thread_local在exit时、静态对象析构之前析构,回调中仍可以使用静态对象
+     */
+    struct RcuThreadHolder
+    {
+        RcuThread *thread = nullptr;
+        ~RcuThreadHolder()
+        {
+            if (Rcu::GetPending())
+            {
+                Rcu::Drain();
+            }
+            if (thread)
+            {
+                RcuThreadExit(thread);
+            }
+        }
+    };
+
+    /**
+     * 等待释放的对象
+     */
+    struct RcuCallback
+    {
+        uint64_t epoch;
+        std::function<void()> cb;
+    };
+
+    static std::atomic<uint64_t> s_rcuEpoch{1};
+    static std::atomic<void (*)()> s_rcuRetireHook{nullptr};
+    static pthread_mutex_t s_rcuMutex = PTHREAD_MUTEX_INITIALIZER;
+    // 日志器和配置在静态初始化期间就会使用RCU,容器在第一次使用时创建,不会被之后的静态初始化清空;
+    // 不析构,退出时其他线程可能还在使用
+    static std::vector<RcuThread *> &RcuThreads()
+    {
+        static std::vector<RcuThread *> *s_threads = new std::vector<RcuThread *>;
+        return *s_threads;
+    }
+    static std::vector<RcuCallback> &RcuCallbacks()
+    {
+        static std::vector<RcuCallback> *s_callbacks = new std::vector<RcuCallback>;
+        return *s_callbacks;
+    }
+    static thread_local RcuThread *t_rcuThread = nullptr;
+    static thread_local RcuThreadHolder t_rcuHolder;
+    static thread_local bool t_rcuQuiescent = false; // 是否为定期调用QuiescentPoint的调度线程
+
+    static void RcuThreadExit(RcuThread *t)
+    {
+        // 退出时已不在读临界区,从列表中移除后不会再被推进epoch时读取
+        pthread_mutex_lock(&s_rcuMutex);
+        std::vector<RcuThread *> &threads = RcuThreads();
+        threads.erase(std::find(threads.begin(), threads.end(), t));
+        pthread_mutex_unlock(&s_rcuMutex);
+        t_rcuThread = nullptr;
+        delete t;
+    }
+
+    void Rcu::Enter()
+    {
+        RcuThread *t = t_rcuThread;
+        if (!t)
+        {
+            t = new RcuThread;
+            pthread_mutex_lock(&s_rcuMutex);
+            RcuThreads().push_back(t);
+            pthread_mutex_unlock(&s_rcuMutex);
+            t_rcuThread = t;
+            t_rcuHolder.thread = t;
+        }
+        if (t->nesting++ == 0)
+        {
+            // 与推进epoch时读取各线程状态配对,之后的读取不能排到前面
+            t->epoch.store(s_rcuEpoch.load(std::memory_order_relaxed), std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+    }
+
+    void Rcu::Exit()
+    {
+        RcuThread *t = t_rcuThread;
+        if (--t->nesting == 0)
+        {
+            t->epoch.store(0, std::memory_order_release);
+        }
+    }
+
+    void Rcu::Retire(std::function<void()> cb)
+    {
+        // 调用前指针已经替换,此时及之后进入的读者看不到旧对象
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        pthread_mutex_lock(&s_rcuMutex);
+        RcuCallbacks().push_back({s_rcuEpoch.load(std::memory_order_relaxed), std::move(cb)});
+        bool first = Pending().fetch_add(1, std::memory_order_relaxed) == 0;
+        pthread_mutex_unlock(&s_rcuMutex);
+        // 构造thread_local,线程退出时执行剩余的回调
+        (void)t_rcuHolder;
+        // 之前没有待释放对象时,空闲线程可能都在无限期睡眠
+        void (*hook)() = s_rcuRetireHook.load(std::memory_order_acquire);
+        if (first && hook)
+        {
+            hook();
+        }
+    }
+
+    void Rcu::SetRetireHook(void (*hook)())
+    {
+        s_rcuRetireHook.store(hook, std::memory_order_release);
+    }
+
+    /**
+     * 所有在读临界区中的线程都已经看到当前epoch时,epoch加1
+     * 需要持有s_rcuMutex
+     */
+    static uint64_t RcuTryAdvance()
+    {
+        uint64_t epoch = s_rcuEpoch.load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        for (auto t : RcuThreads())
+        {
+            uint64_t e = t->epoch.load(std::memory_order_acquire);
+            if (e != 0 && e != epoch)
+            {
+                return epoch;
+            }
+        }
+        s_rcuEpoch.store(epoch + 1, std::memory_order_release);
+        return epoch + 1;
+    }
+
+    void Rcu::Reclaim()
+    {
+        std::vector<std::function<void()>> cbs;
+        pthread_mutex_lock(&s_rcuMutex);
+        uint64_t epoch = RcuTryAdvance();
+        // epoch前进两次后,Retire时在读临界区中的读者都已退出
+        std::vector<RcuCallback> &callbacks = RcuCallbacks();
+        auto it = std::stable_partition(callbacks.begin(), callbacks.end(), [epoch](const RcuCallback &c)
+                                        { return c.epoch + 2 > epoch; });
+        for (auto i = it; i != callbacks.end(); ++i)
+        {
+            cbs.push_back(std::move(i->cb));
+        }
+        callbacks.erase(it, callbacks.end());
+        Pending().fetch_sub(cbs.size(), std::memory_order_relaxed);
+        pthread_mutex_unlock(&s_rcuMutex);
+        // 回调在锁外执行,其中可以再调用Retire
+        for (auto &cb : cbs)
+        {
+            cb();
+        }
+    }
+
+    void Rcu::Synchronize()
+    {
+        uint64_t target = s_rcuEpoch.load(std::memory_order_acquire) + 2;
+        SpinWait([target]()
+                 {
+            pthread_mutex_lock(&s_rcuMutex);
+            uint64_t epoch = RcuTryAdvance();
+            pthread_mutex_unlock(&s_rcuMutex);
+            return epoch >= target; });
+        Reclaim();
+    }
+
+    void Rcu::Collect()
+    {
+        if (!Pending().load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        RcuThread *t = t_rcuThread;
+        if (t_rcuQuiescent || (t && t->nesting > 0))
+        {
+            // 调度线程之后还会经过静止点;在读临界区内同步等待会等到自己
+            Reclaim();
+            return;
+        }
+        Synchronize();
+    }
+
+    void Rcu::SetQuiescentThread(bool v)
+    {
+        t_rcuQuiescent = v;
+    }
+
+    void Rcu::Drain(uint64_t timeout_ms)
+    {
+        RcuThread *t = t_rcuThread;
+        if (t && t->nesting > 0)
+        {
+            return;
+        }
+        uint64_t target = s_rcuEpoch.load(std::memory_order_acquire) + 2;
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        uint64_t deadline = ts.tv_sec * 1000ull + ts.tv_nsec / 1000000 + timeout_ms;
+        while (true)
+        {
+            pthread_mutex_lock(&s_rcuMutex);
+            uint64_t epoch = RcuTryAdvance();
+            pthread_mutex_unlock(&s_rcuMutex);
+            if (epoch >= target)
+            {
+                break;
+            }
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            if (ts.tv_sec * 1000ull + ts.tv_nsec / 1000000 >= deadline)
+            {
+                // 还有读者没有退出,放弃,只执行已经可以执行的回调
+                break;
+            }
+            sched_yield();
+        }
+        Reclaim();
+    }
+
+    // 直方图按2的幂分桶,第0个桶为小于128ns,最后一个桶包含所有更大的值
+    static const int LOCK_HIST_BUCKETS = 24;
+    // 每个线程最多记录的加锁位置
+    static const int LOCK_SITE_SLOTS = 256;
+
+    /**
+     * 一个加锁位置的统计,只由所属线程写,Dump时由其他线程读
+     */
+    struct LockSiteStats
+    {
+        std::atomic<const char *> file{nullptr}; // 不为nullptr时表示已使用
+        int line = 0;
+        std::atomic<uint64_t> count{0};
+        std::atomic<uint64_t> waitNs{0};
+        std::atomic<uint64_t> waitMax{0};
+        std::atomic<uint64_t> holdNs{0};
+        std::atomic<uint32_t> waitHist[LOCK_HIST_BUCKETS] = {};
+        std::atomic<uint32_t> holdHist[LOCK_HIST_BUCKETS] = {};
+    };
+
+    struct ThreadLockTable
+    {
+        LockSiteStats sites[LOCK_SITE_SLOTS];
+        std::atomic<uint64_t> overflow{0}; // 没有空位而丢弃的记录数
+    };
+
+    // 线程退出后统计仍然保留,不会释放
+    static pthread_mutex_t s_lockTablesMutex = PTHREAD_MUTEX_INITIALIZER;
+    static std::vector<ThreadLockTable *> s_lockTables;
+    static thread_local ThreadLockTable *t_lockTable = nullptr;
+
+    static int LockHistBucket(uint64_t ns)
+    {
+        int b = ns < 128 ? 0 : 64 - __builtin_clzll(ns) - 7;
+        return b < LOCK_HIST_BUCKETS ? b : LOCK_HIST_BUCKETS - 1;
+    }
+
+    // 只有所属线程写,不需要原子的读改写
+    template <class V>
+    static void AddRelaxed(std::atomic<V> &v, V n)
+    {
+        v.store(v.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void LockProfiler::Record(const char *file, int line, uint64_t wait_ns, uint64_t hold_ns)
+    {
+        ThreadLockTable *table = t_lockTable;
+        if (!table)
+        {
+            table = new ThreadLockTable;
+            pthread_mutex_lock(&s_lockTablesMutex);
+            s_lockTables.push_back(table);
+            pthread_mutex_unlock(&s_lockTablesMutex);
+            t_lockTable = table;
+        }
+
+        // 开放寻址,同一个位置在同一个编译单元中file指针相同
+        size_t h = ((uintptr_t)file >> 3) * 31 + line;
+        LockSiteStats *site = nullptr;
+        for (int i = 0; i < LOCK_SITE_SLOTS; ++i)
+        {
+            LockSiteStats &s = table->sites[(h + i) % LOCK_SITE_SLOTS];
+            const char *f = s.file.load(std::memory_order_relaxed);
+            if (f == file && s.line == line)
+            {
+                site = &s;
+                break;
+            }
+            if (!f)
+            {
+                s.line = line;
+                s.file.store(file, std::memory_order_release);
+                site = &s;
+                break;
+            }
+        }
+        if (!site)
+        {
+            AddRelaxed<uint64_t>(table->overflow, 1);
+            return;
+        }
+        AddRelaxed<uint64_t>(site->count, 1);
+        AddRelaxed<uint64_t>(site->waitNs, wait_ns);
+        AddRelaxed<uint64_t>(site->holdNs, hold_ns);
+        if (wait_ns > site->waitMax.load(std::memory_order_relaxed))
+        {
+            site->waitMax.store(wait_ns, std::memory_order_relaxed);
+        }
+        AddRelaxed<uint32_t>(site->waitHist[LockHistBucket(wait_ns)], 1);
+        AddRelaxed<uint32_t>(site->holdHist[LockHistBucket(hold_ns)], 1);
+    }
+
+    /**
+     * 汇总后的加锁位置
+     */
+    struct LockSiteSummary
+    {
+        std::string site;
+        uint64_t count = 0;
+        uint64_t waitNs = 0;
+        uint64_t waitMax = 0;
+        uint64_t holdNs = 0;
+        uint64_t waitHist[LOCK_HIST_BUCKETS] = {};
+        uint64_t holdHist[LOCK_HIST_BUCKETS] = {};
+    };
+
+    // 取所在桶的上界
+    static uint64_t LockHistPercentile(const uint64_t *hist, uint64_t count, double p)
+    {
+        uint64_t target = count * p;
+        uint64_t sum = 0;
+        for (int i = 0; i < LOCK_HIST_BUCKETS; ++i)
+        {
+            sum += hist[i];
+            if (sum > target)
+            {
+                return 128ull << i;
+            }
+        }
+        return 128ull << (LOCK_HIST_BUCKETS - 1);
+    }
+
+    std::string LockProfiler::Dump(size_t top)
+    {
+        std::stringstream ss;
+#ifndef SYLAR_LOCK_PROFILE
+        ss << "lock profile disabled, build with SYLAR_LOCK_PROFILE" << std::endl;
+#endif
+        std::map<std::string, LockSiteSummary> sites;
+        uint64_t overflow = 0;
+        pthread_mutex_lock(&s_lockTablesMutex);
+        for (auto table : s_lockTables)
+        {
+            overflow += table->overflow.load(std::memory_order_relaxed);
+            for (auto &s : table->sites)
+            {
+                const char *file = s.file.load(std::memory_order_acquire);
+                if (!file)
+                {
+                    continue;
+                }
+                // 头文件中的加锁位置在不同的编译单元中file指针不同,按文件名合并
+                std::string name = std::string(file) + ":" + std::to_string(s.line);
+                LockSiteSummary &sum = sites[name];
+                sum.site = name;
+                sum.count += s.count.load(std::memory_order_relaxed);
+                sum.waitNs += s.waitNs.load(std::memory_order_relaxed);
+                sum.holdNs += s.holdNs.load(std::memory_order_relaxed);
+                sum.waitMax = std::max<uint64_t>(sum.waitMax, s.waitMax.load(std::memory_order_relaxed));
+                for (int i = 0; i < LOCK_HIST_BUCKETS; ++i)
+                {
+                    sum.waitHist[i] += s.waitHist[i].load(std::memory_order_relaxed);
+                    sum.holdHist[i] += s.holdHist[i].load(std::memory_order_relaxed);
+                }
+            }
+        }
+        pthread_mutex_unlock(&s_lockTablesMutex);
+
+        std::vector<LockSiteSummary *> sorted;
+        for (auto &i : sites)
+        {
+            if (i.second.count)
+            {
+                sorted.push_back(&i.second);
+            }
+        }
+        std::sort(sorted.begin(), sorted.end(), [](LockSiteSummary *a, LockSiteSummary *b)
+                  { return a->waitNs > b->waitNs; });
+        if (sorted.size() > top)
+        {
+            sorted.resize(top);
+        }
+
+        ss << "site\tcount\twait_total_us\twait_avg_ns\twait_max_ns\twait_p99_ns\thold_total_us\thold_p99_ns" << std::endl;
+        for (auto i : sorted)
+        {
+            ss << i->site << "\t" << i->count
+               << "\t" << i->waitNs / 1000
+               << "\t" << i->waitNs / i->count
+               << "\t" << i->waitMax
+               << "\t" << LockHistPercentile(i->waitHist, i->count, 0.99)
+               << "\t" << i->holdNs / 1000
+               << "\t" << LockHistPercentile(i->holdHist, i->count, 0.99) << std::endl;
+        }
+        if (overflow)
+        {
+            ss << "dropped " << overflow << " records, too many lock sites" << std::endl;
+        }
+        return ss.str();
+    }
+
+    uint64_t LockProfiler::GetCount(const std::string &file, int line)
+    {
+        uint64_t count = 0;
+        pthread_mutex_lock(&s_lockTablesMutex);
+        for (auto table : s_lockTables)
+        {
+            for (auto &s : table->sites)
+            {
+                const char *f = s.file.load(std::memory_order_acquire);
+                if (f && s.line == line && file == f)
+                {
+                    count += s.count.load(std::memory_order_relaxed);
+                }
+            }
+        }
+        pthread_mutex_unlock(&s_lockTablesMutex);
+        return count;
+    }
+
+    void LockProfiler::Reset()
+    {
+        pthread_mutex_lock(&s_lockTablesMutex);
+        for (auto table : s_lockTables)
+        {
+            table->overflow.store(0, std::memory_order_relaxed);
+            for (auto &s : table->sites)
+            {
+                s.count.store(0, std::memory_order_relaxed);
+                s.waitNs.store(0, std::memory_order_relaxed);
+                s.waitMax.store(0, std::memory_order_relaxed);
+                s.holdNs.store(0, std::memory_order_relaxed);
+                for (int i = 0; i < LOCK_HIST_BUCKETS; ++i)
+                {
+                    s.waitHist[i].store(0, std::memory_order_relaxed);
+                    s.holdHist[i].store(0, std::memory_order_relaxed);
+                }
+            }
+        }
+        pthread_mutex_unlock(&s_lockTablesMutex);
+    }
+}
@@ -4,6 +4,13 @@
 #include <semaphore.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <time.h>
+#include <atomic>
+#include <string>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <type_traits>
 
 #include "noncopyable.h"
 
@@ -32,6 +39,82 @@ namespace sylar
         sem_t m_semaphore;
     };
 
+    /**
+     * 锁竞争分析
+     * 编译时定义SYLAR_LOCK_PROFILE(cmake -DSYLAR_LOCK_PROFILE=ON)后,所有局部锁(Lock/ReadLock/WriteLock)
+     * 按照构造的位置(文件:行号)记录等待时间和持有时间,每个线程一份统计,Dump时汇总
+     * 没有定义时局部锁中不包含任何统计代码
+     */
+    class LockProfiler
+    {
+    public:
+        /**
+         * 记录一次加锁,只由局部锁调用
+         * @param wait_ns 等待加锁的时间
+         * @param hold_ns 持有锁的时间
+         */
+        static void Record(const char *file, int line, uint64_t wait_ns, uint64_t hold_ns);
+
+        /**
+         * @brief 按总等待时间从大到小输出前top个加锁位置
+         * 包括次数、总等待/平均/最大/p99等待时间和总持有/p99持有时间
+         */
+        static std::string Dump(size_t top = 20);
+
+        /**
+         * 一个加锁位置在所有线程中的加锁次数
+         */
+        static uint64_t GetCount(const std::string &file, int line);
+
+        /**
+         * 清空所有线程的统计,与正在进行的记录不同步,只用于分段观察
+         */
+        static void Reset();
+
+        static uint64_t Now()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+        }
+    };
+
+#ifdef SYLAR_LOCK_PROFILE
+    /**
+     * 局部锁的计时
+     */
+    class LockSiteTimer
+    {
+    public:
+        LockSiteTimer(const char *file, int line) : m_file(file), m_line(line) {}
+
+        void beforeLock() { m_start = LockProfiler::Now(); }
+        void afterLock() { m_locked = LockProfiler::Now(); }
+        void afterUnlock() { LockProfiler::Record(m_file, m_line, m_locked - m_start, LockProfiler::Now() - m_locked); }
+
+    private:
+        const char *m_file;
+        int m_line;
+        uint64_t m_start = 0;
+        uint64_t m_locked = 0;
+    };
+
+// 构造局部锁的位置,默认参数在调用处求值
+#define SYLAR_LOCK_SITE_PARAMS , const char *file = __builtin_FILE(), int line = __builtin_LINE()
+#define SYLAR_LOCK_SITE_INIT , m_timer(file, line)
+#define SYLAR_LOCK_SITE_MEMBER LockSiteTimer m_timer;
+#define SYLAR_LOCK_BEFORE() m_timer.beforeLock()
+#define SYLAR_LOCK_AFTER() m_timer.afterLock()
+#define SYLAR_LOCK_RELEASED() m_timer.afterUnlock()
+#else
+#define SYLAR_LOCK_SITE_PARAMS
+#define SYLAR_LOCK_SITE_INIT
+#define SYLAR_LOCK_SITE_MEMBER
+#define SYLAR_LOCK_BEFORE()
+#define SYLAR_LOCK_AFTER()
+#define SYLAR_LOCK_RELEASED()
+#endif
+
     /**
      * 类似于与一个适配器
      * 写一个通用的模板类去管理他们
@@ -42,9 +125,11 @@ namespace sylar
     struct ScopedLockImpl
     {
     public:
-        ScopedLockImpl(T &mutex) : m_mutex(mutex)
+        ScopedLockImpl(T &mutex SYLAR_LOCK_SITE_PARAMS) : m_mutex(mutex) SYLAR_LOCK_SITE_INIT
         {
+            SYLAR_LOCK_BEFORE();
             m_mutex.lock();
+            SYLAR_LOCK_AFTER();
             m_locked = true;
         }
 
@@ -59,7 +144,9 @@ namespace sylar
             // 判断是否已经加锁，防止重复加锁造成死锁
             if (!m_locked)
             {
+                SYLAR_LOCK_BEFORE();
                 m_mutex.lock();
+                SYLAR_LOCK_AFTER();
                 m_locked = true;
             }
         }
@@ -69,6 +156,7 @@ namespace sylar
             if (m_locked)
             {
                 m_mutex.unlock();
+                SYLAR_LOCK_RELEASED();
                 m_locked = false;
             }
         }
@@ -76,6 +164,7 @@ namespace sylar
     private:
         T &m_mutex;
         bool m_locked; // 锁的状态
+        SYLAR_LOCK_SITE_MEMBER
     };
 
     /**
@@ -118,9 +207,11 @@ namespace sylar
     class ReadScopedLockImpl
     {
     public:
-        ReadScopedLockImpl(T &mutex) : m_mutex(mutex)
+        ReadScopedLockImpl(T &mutex SYLAR_LOCK_SITE_PARAMS) : m_mutex(mutex) SYLAR_LOCK_SITE_INIT
         {
+            SYLAR_LOCK_BEFORE();
             m_mutex.rdlock();
+            SYLAR_LOCK_AFTER();
             m_locked = true;
         }
 
@@ -134,7 +225,9 @@ namespace sylar
             // 判断是否已经加锁，防止重复加锁造成死锁
             if (!m_locked)
             {
+                SYLAR_LOCK_BEFORE();
                 m_mutex.rdlock();
+                SYLAR_LOCK_AFTER();
                 m_locked = true;
             }
         }
@@ -144,6 +237,7 @@ namespace sylar
             if (m_locked)
             {
                 m_mutex.unlock();
+                SYLAR_LOCK_RELEASED();
                 m_locked = false;
             }
         }
@@ -151,6 +245,7 @@ namespace sylar
     private:
         T &m_mutex;    // mutex
         bool m_locked; // 锁的状态
+        SYLAR_LOCK_SITE_MEMBER
     };
 
     /**
@@ -160,9 +255,11 @@ namespace sylar
     struct WriteScopedLockImpl
     {
     public:
-        WriteScopedLockImpl(T &mutex) : m_mutex(mutex)
+        WriteScopedLockImpl(T &mutex SYLAR_LOCK_SITE_PARAMS) : m_mutex(mutex) SYLAR_LOCK_SITE_INIT
         {
+            SYLAR_LOCK_BEFORE();
             m_mutex.wrlock();
+            SYLAR_LOCK_AFTER();
             m_locked = true;
         }
 
@@ -176,7 +273,9 @@ namespace sylar
             // 判断是否已经加锁，防止重复加锁造成死锁
             if (!m_locked)
             {
+                SYLAR_LOCK_BEFORE();
                 m_mutex.wrlock();
+                SYLAR_LOCK_AFTER();
                 m_locked = true;
             }
         }
@@ -186,6 +285,7 @@ namespace sylar
             if (m_locked)
             {
                 m_mutex.unlock();
+                SYLAR_LOCK_RELEASED();
                 m_locked = false;
             }
         }
@@ -193,6 +293,7 @@ namespace sylar
     private:
         T &m_mutex;    // mutex
         bool m_locked; // 锁的状态
+        SYLAR_LOCK_SITE_MEMBER
     };
 
     class RWMutex : Noncopyable
@@ -277,6 +378,437 @@ namespace sylar
         pthread_spinlock_t m_mutex;
     };
 
+    /**
+     * 自旋等待时让出流水线,降低功耗,也让超线程的另一个逻辑核运行
+     */
+    inline void CpuRelax()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__)
+        asm volatile("yield" ::: "memory");
+#endif
+    }
+
+    /**
+     * 自适应互斥量
+     * 没有竞争时只有一次CAS;有竞争时先短暂自旋(pause+指数退避),仍未拿到锁则在futex上睡眠
+     * 持有者被调度出去时不会像Spinlock一样一直占用CPU
+     * 同时记录竞争统计,可以在运行时读取
+     */
+    class AdaptiveMutex : Noncopyable
+    {
+    public:
+        // 局部锁
+        typedef ScopedLockImpl<AdaptiveMutex> Lock;
+
+        /**
+         * 竞争统计
+         */
+        struct Stats
+        {
+            uint64_t acquisitions = 0; // 加锁次数
+            uint64_t contended = 0;    // 第一次尝试没有拿到锁的次数
+            uint64_t parked = 0;       // 自旋后仍没有拿到锁,在futex上睡眠的次数
+            uint64_t waitNs = 0;       // 有竞争时等待锁的总时间,纳秒
+        };
+
+        /**
+         * 自旋的最大轮数,每轮pause的次数从1开始翻倍,最多SPIN_MAX_PAUSE次
+         */
+        static const int SPIN_ROUNDS = 10;
+        static const int SPIN_MAX_PAUSE = 64;
+
+        AdaptiveMutex() {}
+
+        void lock()
+        {
+            uint32_t c = UNLOCKED;
+            if (!m_state.compare_exchange_strong(c, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                lockSlow();
+            }
+            countAcquisition();
+        }
+
+        bool tryLock()
+        {
+            uint32_t c = UNLOCKED;
+            if (m_state.compare_exchange_strong(c, LOCKED, std::memory_order_acquire, std::memory_order_relaxed))
+            {
+                countAcquisition();
+                return true;
+            }
+            return false;
+        }
+
+        void unlock()
+        {
+            // 有线程在futex上睡眠时才需要系统调用
+            if (m_state.exchange(UNLOCKED, std::memory_order_release) == PARKED)
+            {
+                wake();
+            }
+        }
+
+        /**
+         * 读取竞争统计,各项分别读取,不是一个一致的快照
+         */
+        Stats getStats() const;
+
+        /**
+         * 清空竞争统计,加锁次数由持有者非原子地累加,与加锁同时进行时可能没有清零
+         */
+        void resetStats();
+
+    private:
+        void lockSlow();
+        void wake();
+
+        /**
+         * 加锁次数加1,持有锁时调用,只有持有者写,不需要原子的读-改-写,无竞争时仍只有一次CAS
+         */
+        void countAcquisition()
+        {
+            m_acquisitions.store(m_acquisitions.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+    private:
+        enum State : uint32_t
+        {
+            UNLOCKED = 0, // 未加锁
+            LOCKED = 1,   // 已加锁,没有睡眠的等待者
+            PARKED = 2    // 已加锁,可能有睡眠的等待者
+        };
+        std::atomic<uint32_t> m_state{UNLOCKED};
+        std::atomic<uint64_t> m_acquisitions{0}; // 只在持有锁时修改
+        std::atomic<uint64_t> m_contended{0};
+        std::atomic<uint64_t> m_parked{0};
+        std::atomic<uint64_t> m_waitNs{0};
+    };
+
+    /**
+     * 大读者读写锁(big-reader lock),写优先
+     * 读者只修改自己线程对应槽位的计数,不同线程的读锁不会争用同一个缓存行
+     * 写者设置写标记后等待所有槽位的计数之和为0,写标记存在时新的读者等待
+     * 适合读非常频繁、写很少的场景,如IOManager的fd上下文数组
+     * 每个锁占用SLOTS个缓存行,不适合大量实例
+     * 持有写锁的协程不能切换到其他线程解锁
+     */
+    class BrRWMutex : Noncopyable
+    {
+    public:
+        // 局部读锁
+        typedef ReadScopedLockImpl<BrRWMutex> ReadLock;
+        // 局部写锁
+        typedef WriteScopedLockImpl<BrRWMutex> WriteLock;
+
+        // 读者槽位数,线程按顺序分配槽位,超过后多个线程共用
+        static const int SLOTS = 64;
+
+        BrRWMutex()
+        {
+            pthread_mutex_init(&m_wmutex, nullptr);
+        }
+
+        ~BrRWMutex()
+        {
+            pthread_mutex_destroy(&m_wmutex);
+        }
+
+        void rdlock()
+        {
+            std::atomic<int64_t> &count = m_slots[SlotIndex()].count;
+            // 与写者设置标记后读取槽位配对,两者至少有一方能看到对方
+            count.fetch_add(1, std::memory_order_seq_cst);
+            if (m_writer.load(std::memory_order_seq_cst))
+            {
+                rdlockSlow(count);
+            }
+        }
+
+        void wrlock();
+
+        void unlock()
+        {
+            if (m_owner.load(std::memory_order_relaxed) == ThreadToken())
+            {
+                m_owner.store(nullptr, std::memory_order_relaxed);
+                m_writer.store(false, std::memory_order_release);
+                pthread_mutex_unlock(&m_wmutex);
+                return;
+            }
+            // 协程在其他线程解锁时减在另一个槽位上,写者只看所有槽位的和,结果不变
+            m_slots[SlotIndex()].count.fetch_sub(1, std::memory_order_release);
+        }
+
+    private:
+        void rdlockSlow(std::atomic<int64_t> &count);
+
+        /**
+         * 当前线程的读者槽位
+         */
+        static int SlotIndex()
+        {
+            static std::atomic<uint32_t> s_next{0};
+            static thread_local int t_index = s_next.fetch_add(1, std::memory_order_relaxed) % SLOTS;
+            return t_index;
+        }
+
+        /**
+         * 当前线程的唯一标识,用于区分解锁的是读锁还是写锁
+         */
+        static const void *ThreadToken()
+        {
+            static thread_local char t_token;
+            return &t_token;
+        }
+
+    private:
+        struct alignas(64) Slot
+        {
+            std::atomic<int64_t> count{0}; // 在该槽位上加读锁的次数
+        };
+        Slot m_slots[SLOTS];
+        alignas(64) std::atomic<bool> m_writer{false}; // 有写者持有或等待写锁
+        std::atomic<const void *> m_owner{nullptr};   // 持有写锁的线程
+        pthread_mutex_t m_wmutex;                      // 串行化写者
+    };
+
+    /**
+     * 顺序锁,适合频繁读取、很少修改的小块POD数据
+     * 读者不写共享内存,读到写了一半的数据时重试;写者之间用锁串行
+     * 数据按8字节保存在原子变量中,读写并发时也没有数据竞争
+     */
+    template <class T>
+    class SeqLock : Noncopyable
+    {
+    public:
+        static_assert(std::is_trivially_copyable<T>::value, "SeqLock requires trivially copyable T");
+
+        SeqLock(const T &val = T())
+        {
+            store(val);
+        }
+
+        /**
+         * 读取一份一致的拷贝
+         */
+        T load() const
+        {
+            uint64_t buf[WORDS];
+            while (true)
+            {
+                uint32_t seq = m_seq.load(std::memory_order_acquire);
+                if (seq & 1)
+                {
+                    // 正在写
+                    CpuRelax();
+                    continue;
+                }
+                for (size_t i = 0; i < WORDS; ++i)
+                {
+                    buf[i] = m_data[i].load(std::memory_order_relaxed);
+                }
+                // 数据的读取不能排到再次读取序号之后
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (m_seq.load(std::memory_order_relaxed) == seq)
+                {
+                    break;
+                }
+            }
+            T val;
+            memcpy((void *)&val, buf, sizeof(T));
+            return val;
+        }
+
+        void store(const T &val)
+        {
+            uint64_t buf[WORDS] = {0};
+            memcpy(buf, (const void *)&val, sizeof(T));
+            AdaptiveMutex::Lock lock(m_mutex);
+            uint32_t seq = m_seq.load(std::memory_order_relaxed);
+            m_seq.store(seq + 1, std::memory_order_relaxed);
+            // 序号变为奇数必须先于数据的修改被看到
+            std::atomic_thread_fence(std::memory_order_release);
+            for (size_t i = 0; i < WORDS; ++i)
+            {
+                m_data[i].store(buf[i], std::memory_order_relaxed);
+            }
+            m_seq.store(seq + 2, std::memory_order_release);
+        }
+
+    private:
+        static const size_t WORDS = (sizeof(T) + 7) / 8;
+        std::atomic<uint32_t> m_seq{0};      // 序号,奇数表示正在写
+        std::atomic<uint64_t> m_data[WORDS]; // 数据
+        AdaptiveMutex m_mutex;               // 串行化写者
+    };
+
+    /**
+     * 基于epoch的RCU
+     * 读者用Rcu::ReadLock标记读临界区,只写自己线程的状态;写者替换指针后用Retire延迟释放旧对象
+     * 所有在替换前进入读临界区的读者都退出后(全局epoch前进两次),旧对象才被释放
+     * 释放由QuiescentPoint驱动,Scheduler每次调度循环都会调用,有待释放对象时空闲线程定期醒来推进;
+     * 不在调度器中的线程没有静止点,写者在释放锁后调用Collect同步等待两个宽限期;
+     * 线程退出(包括主线程exit)时在读者都退出后执行剩余的回调
+     * 读临界区可以嵌套,但不能跨越协程切换,也不能在其中调用Synchronize
+     *
+     * {
+     *     sylar::Rcu::ReadLock lock;
+     *     Data *data = g_data.load(std::memory_order_acquire);
+     *     ...
+     * }
+     * Data *old = g_data.exchange(new Data);
+     * sylar::Rcu::Retire(old);
+     */
+    class Rcu
+    {
+    public:
+        /**
+         * 局部读临界区
+         */
+        class ReadLock : Noncopyable
+        {
+        public:
+            ReadLock() { Rcu::Enter(); }
+            ~ReadLock() { Rcu::Exit(); }
+        };
+
+        /**
+         * 进入读临界区
+         */
+        static void Enter();
+
+        /**
+         * 退出读临界区
+         */
+        static void Exit();
+
+        /**
+         * 在当前所有读者退出后执行cb,通常用于释放旧对象
+         */
+        static void Retire(std::function<void()> cb);
+
+        template <class T>
+        static void Retire(T *ptr)
+        {
+            Retire([ptr]()
+                   { delete ptr; });
+        }
+
+        /**
+         * @brief 静止点,尝试推进epoch并执行可以执行的回调
+         * 没有待释放对象时只有一次原子读
+         */
+        static void QuiescentPoint()
+        {
+            if (Pending().load(std::memory_order_relaxed))
+            {
+                Reclaim();
+            }
+        }
+
+        /**
+         * 等待调用前进入读临界区的读者全部退出(两个宽限期),并执行已经可以执行的回调
+         */
+        static void Synchronize();
+
+        /**
+         * @brief 写者Retire之后调用,需要不在读临界区内、不持有读者可能等待的锁
+         * 调度线程中只推进一次(之后的调度循环继续推进);其他线程调用Synchronize同步释放,
+         * 旧对象的析构(关闭文件、连接)在返回前完成
+         */
+        static void Collect();
+
+        /**
+         * @brief 标记当前线程会定期调用QuiescentPoint,Scheduler::run在调度期间设置
+         */
+        static void SetQuiescentThread(bool v);
+
+        /**
+         * @brief 等待读者都退出后执行所有待释放的回调,读者长时间不退出时放弃
+         * 线程退出时自动调用
+         * @param timeout_ms 最长等待时间
+         */
+        static void Drain(uint64_t timeout_ms = 100);
+
+        /**
+         * @brief 设置没有待释放对象时Retire之后的通知函数
+         * Scheduler设置为唤醒空闲线程,避免所有线程都在睡眠时旧对象一直得不到释放
+         */
+        static void SetRetireHook(void (*hook)());
+
+        /**
+         * 等待释放的对象个数
+         */
+        static size_t GetPending() { return Pending().load(std::memory_order_relaxed); }
+
+    private:
+        static void Reclaim();
+
+        static std::atomic<size_t> &Pending()
+        {
+            static std::atomic<size_t> s_pending{0};
+            return s_pending;
+        }
+    };
+
+    /**
+     * 用RCU保护的shared_ptr,代替std::atomic_load/atomic_store(libstdc++用全局的互斥锁池实现)
+     * load()在读临界区内复制shared_ptr,只有一次引用计数的原子加;
+     * 已经在读临界区中的读者可以用get()直接使用当前对象,不修改引用计数
+     * store()替换后旧的shared_ptr由Rcu::Retire延迟释放
+     */
+    template <class T>
+    class RcuPtr : Noncopyable
+    {
+    public:
+        typedef std::shared_ptr<T> ptr;
+
+        explicit RcuPtr(ptr p = nullptr)
+            : m_ptr(new ptr(std::move(p)))
+        {
+        }
+
+        ~RcuPtr()
+        {
+            delete m_ptr.load(std::memory_order_relaxed);
+        }
+
+        /**
+         * 取得当前对象的引用,之后的store不会影响已经取得的引用
+         */
+        ptr load() const
+        {
+            Rcu::ReadLock lock;
+            return *m_ptr.load(std::memory_order_acquire);
+        }
+
+        /**
+         * 需在读临界区内调用,返回的指针在退出读临界区前有效
+         */
+        T *get() const
+        {
+            return m_ptr.load(std::memory_order_acquire)->get();
+        }
+
+        /**
+         * 替换对象,多个写者需要自己串行化
+         * 可能在持有锁时调用,只推进一次释放;不在调度器中的写者释放锁后再调用Rcu::Collect()
+         */
+        void store(ptr p)
+        {
+            ptr *old = m_ptr.exchange(new ptr(std::move(p)), std::memory_order_acq_rel);
+            Rcu::Retire(old);
+            // 写者顺带推进释放,不在调度器中的程序也不会一直积压
+            Rcu::QuiescentPoint();
+        }
+
+    private:
+        std::atomic<ptr *> m_ptr;
+    };
+
 }
 
 #endif
\ No newline at end of file
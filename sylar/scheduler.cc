@@ -1,6 +1,13 @@
 #include "scheduler.h"
 #include "log.h"
 #include "macro.h"
+#include "config.h"
+#include <time.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <algorithm>
 
 namespace sylar
 {
@@ -10,11 +17,58 @@ namespace sylar
     static thread_local Scheduler *t_scheduler = nullptr;
     // 调度器中当前线程的调度协程
     static thread_local Fiber *t_scheduler_fiber = nullptr;
+    // 调度循环查找任务之前读到的事件计数,idle时与之比较,之后有tickle则不睡眠
+    static thread_local uint32_t t_idle_key = 0;
+    // 当前线程在调度器中的截止时间堆下标,不是调度线程为-1
+    static thread_local int t_deadline_index = -1;
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_idle_spin =
+        Config::Lookup<uint32_t>("scheduler.idle_spin_us", 50, "scheduler idle spin before park, us");
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_aging =
+        Config::Lookup<uint32_t>("scheduler.aging_ms", 100, "scheduler priority aging, ms");
+
+    static const char *const s_deadline_policies[] = {"run", "drop", "callback"};
+    static constexpr ConfigSchema s_deadline_policy_schema = ConfigSchema().oneOf(s_deadline_policies);
+    static ConfigVar<std::string>::ptr g_scheduler_deadline_policy =
+        Config::Lookup<std::string>("scheduler.deadline_policy", "run",
+                                    "policy for deadline tasks that missed their deadline: run|drop|callback",
+                                    s_deadline_policy_schema);
+
+    static ConfigVar<uint32_t>::ptr g_scheduler_fiber_pool_size =
+        Config::Lookup<uint32_t>("scheduler.fiber_pool_size", 16, "terminated fibers cached per scheduler thread");
+
+    // 有RCU对象等待释放时,空闲线程最多睡眠这么久就回到调度循环推进释放
+    static const uint32_t RCU_IDLE_POLL_MS = 10;
+
+    // 运行中的调度器,RCU有待释放对象时唤醒它们的空闲线程
+    // 不析构,静态对象析构时仍可能有Retire
+    static Mutex &RunningMutex()
+    {
+        static Mutex *s_mutex = new Mutex;
+        return *s_mutex;
+    }
+
+    static std::vector<Scheduler *> &RunningSchedulers()
+    {
+        static std::vector<Scheduler *> *s_schedulers = new std::vector<Scheduler *>;
+        return *s_schedulers;
+    }
+
+    static uint64_t IdleNowUs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000ull + ts.tv_nsec / 1000;
+    }
 
     Scheduler::Scheduler(size_t threads, bool use_caller, const std::string &name)
         : m_name(name)
     {
         SYLAR_ASSERT(threads > 0);
+        m_idleSpinUs = g_scheduler_idle_spin->getValue();
+        m_agingMs = g_scheduler_aging->getValue();
+        m_fiberPoolSize = g_scheduler_fiber_pool_size->getValue();
         // use_caller 是否使用当前调用线程
 
         // 是否将当前的线程加入调度？
@@ -44,11 +98,39 @@ namespace sylar
             m_rootThread = -1;
         }
         m_threadCount = threads;
+
+        // 每个调度线程(包括caller线程)一个截止时间堆
+        size_t workers = m_threadCount + (m_rootThread != -1 ? 1 : 0);
+        for (size_t i = 0; i < workers; ++i)
+        {
+            m_deadlineQueues.emplace_back(new DeadlineQueue);
+        }
+        const std::string &policy = g_scheduler_deadline_policy->getValue();
+        for (int i = 0; i < 3; ++i)
+        {
+            if (policy == s_deadline_policies[i])
+            {
+                m_deadlinePolicy = i;
+            }
+        }
     }
 
     Scheduler::~Scheduler()
     {
         SYLAR_ASSERT(m_stopping);
+        // 释放协程队列持有的引用
+        for (int i = 0; i < PRIORITY_COUNT; ++i)
+        {
+            Fiber *f = m_readyFibers[i].head;
+            while (f)
+            {
+                Fiber *next = f->m_queueNext;
+                f->m_queueNext = nullptr;
+                f->m_queued = false;
+                f->decRef();
+                f = next;
+            }
+        }
         if (GetThis() == this)
         {
             t_scheduler = nullptr;
@@ -69,10 +151,37 @@ namespace sylar
         SYLAR_LOG_INFO(g_logger) << "idle function";
         while (!stopping())
         {
-            // 当stopping()为false，也就是调度还没停止，还有活跃的线程，将idle进程挂起，状态转为Hold
+            // 调度循环查找任务之后没有新的tickle,先自旋一小段时间,再在futex上睡眠,等待tickle精确唤醒
+            uint32_t key = t_idle_key;
+            uint32_t spin_us = m_idleSpinUs;
+            if (spin_us && m_idleSeq.load(std::memory_order_acquire) == key)
+            {
+                uint64_t deadline = IdleNowUs() + spin_us;
+                for (int i = 1; m_idleSeq.load(std::memory_order_acquire) == key; ++i)
+                {
+                    CpuRelax();
+                    if (i % 64 == 0 && IdleNowUs() >= deadline)
+                    {
+                        break;
+                    }
+                }
+            }
+            m_idleWaiters.fetch_add(1, std::memory_order_seq_cst);
+            if (m_idleSeq.load(std::memory_order_seq_cst) == key)
+            {
+                // 有RCU对象等待释放时定时醒来,回到调度循环的静止点推进epoch
+                struct timespec poll = {0, RCU_IDLE_POLL_MS * 1000000l};
+                syscall(SYS_futex, (uint32_t *)&m_idleSeq, FUTEX_WAIT_PRIVATE, key,
+                        Rcu::GetPending() ? &poll : nullptr, nullptr, 0);
+            }
+            m_idleWaiters.fetch_sub(1, std::memory_order_relaxed);
+            // 回到调度循环查找任务
             sylar::Fiber::YieldToHold();
         }
         // 当stopping()为true，没有任务要执行了，则idel一直执行(配合run函数内的while循环中swapIn())
+        // 唤醒其他还在睡眠的空闲线程,让它们也检查一次是否可以停止
+        m_idleSeq.fetch_add(1, std::memory_order_seq_cst);
+        syscall(SYS_futex, (uint32_t *)&m_idleSeq, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
     }
 
     /**D
@@ -93,7 +202,231 @@ namespace sylar
          * 则 返回true,代表没有任务要执行了
          *
          */
-        return m_autoStop && m_stopping && m_fibers.empty() && m_activeThreadCount == 0;
+        return m_autoStop && m_stopping && m_taskCount == 0 && m_deadlineCount == 0 && m_activeThreadCount == 0;
+    }
+
+    uint64_t Scheduler::NowMs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return ts.tv_sec * 1000ull + ts.tv_nsec / 1000000;
+    }
+
+    bool Scheduler::enqueueNoLock(FiberAndThread &ft, Priority priority)
+    {
+        uint64_t now = NowMs();
+        if (ft.fiber && ft.fiber->m_deadlineMs)
+        {
+            // 截止时间任务让出(HOLD)后被重新调度,仍按原截止时间执行
+            ft.deadlineMs = ft.fiber->m_deadlineMs;
+            ft.enqueueMs = now;
+            pushDeadline(ft, true);
+            return true;
+        }
+        if (ft.fiber)
+        {
+            Fiber *f = ft.fiber.get();
+            // 侵入式队列中一个协程只能出现一次,重复调度会让协程执行两次,是调用者的错误
+            SYLAR_ASSERT2(!f->m_queued, "fiber id=" << f->getId() << " is already scheduled");
+            if (f->m_queued)
+            {
+                // 关闭断言(NDEBUG)时已经输出错误日志,丢弃这次调度
+                return false;
+            }
+            // 队列接管ft.fiber的引用
+            ft.fiber.detach();
+            f->m_queued = true;
+            f->m_queueNext = nullptr;
+            f->m_queueSeq = ++m_queueSeq;
+            f->m_enqueueMs = now;
+            f->m_queueThread = ft.thread;
+            f->m_queuePriority = priority;
+            FiberQueue &q = m_readyFibers[priority];
+            if (q.tail)
+            {
+                q.tail->m_queueNext = f;
+            }
+            else
+            {
+                q.head = f;
+            }
+            q.tail = f;
+        }
+        else
+        {
+            ft.priority = priority;
+            ft.enqueueMs = now;
+            ft.seq = ++m_queueSeq;
+            m_fibers[priority].push_back(std::move(ft));
+        }
+        ++m_taskCount;
+        QueueStats &stats = m_queueStats[priority];
+        ++stats.scheduled;
+        if (++stats.depth > stats.maxDepth)
+        {
+            stats.maxDepth = stats.depth;
+        }
+        return false;
+    }
+
+    bool Scheduler::queueEmpty(int priority) const
+    {
+        return m_fibers[priority].empty() && !m_readyFibers[priority].head;
+    }
+
+    void Scheduler::queueOrder(int *order)
+    {
+        uint64_t now = NowMs();
+        uint64_t aging = m_agingMs;
+        int64_t effective[PRIORITY_COUNT];
+        for (int i = 0; i < PRIORITY_COUNT; ++i)
+        {
+            order[i] = i;
+            if (queueEmpty(i))
+            {
+                effective[i] = INT64_MAX;
+                continue;
+            }
+            // 队首为函数队列和协程队列中先入队的一个
+            const std::list<FiberAndThread> &cbs = m_fibers[i];
+            const Fiber *f = m_readyFibers[i].head;
+            uint64_t head_ms = !f || (!cbs.empty() && cbs.front().seq < f->m_queueSeq)
+                                   ? cbs.front().enqueueMs
+                                   : f->m_enqueueMs;
+            effective[i] = (int64_t)(i * aging) - (int64_t)(now - head_ms);
+        }
+        // 优先级相同时保持高优先级在前
+        std::stable_sort(order, order + PRIORITY_COUNT, [&effective](int a, int b)
+                         { return effective[a] < effective[b]; });
+    }
+
+    Scheduler::QueueStats Scheduler::getQueueStats(Priority priority)
+    {
+        MutexType::Lock lock(m_mutex);
+        return m_queueStats[priority];
+    }
+
+    void Scheduler::pushDeadline(FiberAndThread &ft, bool started)
+    {
+        size_t n = m_deadlineQueues.size();
+        size_t idx;
+        if (GetThis() == this && t_deadline_index >= 0 && (size_t)t_deadline_index < n)
+        {
+            // 调度线程加入的任务放到自己的堆中
+            idx = t_deadline_index;
+        }
+        else
+        {
+            idx = m_deadlineNext.fetch_add(1, std::memory_order_relaxed) % n;
+        }
+        ft.started = started;
+        if (!started)
+        {
+            ++m_deadlineScheduled;
+        }
+        DeadlineQueue &q = *m_deadlineQueues[idx];
+        Mutex::Lock lock(q.mutex);
+        q.heap.push_back(std::move(ft));
+        std::push_heap(q.heap.begin(), q.heap.end(), [](const FiberAndThread &a, const FiberAndThread &b)
+                       { return a.deadlineMs > b.deadlineMs; });
+        q.top.store(q.heap.front().deadlineMs, std::memory_order_release);
+        // 先放入堆再增加计数,看到计数的线程一定能找到任务
+        ++m_deadlineCount;
+    }
+
+    bool Scheduler::popDeadline(FiberAndThread &ft)
+    {
+        size_t n = m_deadlineQueues.size();
+        size_t self = t_deadline_index >= 0 && (size_t)t_deadline_index < n ? t_deadline_index : 0;
+        while (m_deadlineCount.load(std::memory_order_acquire))
+        {
+            // 无锁比较各个堆顶,选择截止时间最早的堆,相同时优先自己的堆
+            size_t best = self;
+            uint64_t best_top = m_deadlineQueues[self]->top.load(std::memory_order_acquire);
+            for (size_t i = 0; i < n; ++i)
+            {
+                uint64_t top = m_deadlineQueues[i]->top.load(std::memory_order_acquire);
+                if (top < best_top)
+                {
+                    best = i;
+                    best_top = top;
+                }
+            }
+            if (best_top == UINT64_MAX)
+            {
+                return false;
+            }
+
+            DeadlineQueue &q = *m_deadlineQueues[best];
+            {
+                Mutex::Lock lock(q.mutex);
+                if (q.heap.empty())
+                {
+                    // 被其他线程取走了,重新选择
+                    continue;
+                }
+                std::pop_heap(q.heap.begin(), q.heap.end(), [](const FiberAndThread &a, const FiberAndThread &b)
+                              { return a.deadlineMs > b.deadlineMs; });
+                ft = std::move(q.heap.back());
+                q.heap.pop_back();
+                q.top.store(q.heap.empty() ? UINT64_MAX : q.heap.front().deadlineMs, std::memory_order_release);
+                // 与查找优先级队列一致,取出任务时就算作活跃线程,stopping()不会在两者之间看到全0
+                ++m_activeThreadCount;
+                --m_deadlineCount;
+            }
+            if (best != self)
+            {
+                ++m_deadlineStolen;
+            }
+
+            if (ft.started)
+            {
+                return true;
+            }
+            if (NowMs() <= ft.deadlineMs)
+            {
+                ++m_deadlineMet;
+                return true;
+            }
+
+            ++m_deadlineMissed;
+            int policy = m_deadlinePolicy;
+            if (policy == DEADLINE_RUN)
+            {
+                return true;
+            }
+            ++m_deadlineShed;
+            if (policy == DEADLINE_CALLBACK && ft.onMiss)
+            {
+                ft.fiber = nullptr;
+                ft.cb = std::move(ft.onMiss);
+                return true;
+            }
+            // 丢弃,继续取下一个
+            ft.reset();
+            --m_activeThreadCount;
+        }
+        return false;
+    }
+
+    Scheduler::DeadlineStats Scheduler::getDeadlineStats()
+    {
+        DeadlineStats stats;
+        stats.scheduled = m_deadlineScheduled;
+        stats.met = m_deadlineMet;
+        stats.missed = m_deadlineMissed;
+        stats.shed = m_deadlineShed;
+        stats.stolen = m_deadlineStolen;
+        return stats;
+    }
+
+    Scheduler::FiberPoolStats Scheduler::getFiberPoolStats()
+    {
+        FiberPoolStats stats;
+        stats.hit = m_fiberPoolHit;
+        stats.miss = m_fiberPoolMiss;
+        stats.recycled = m_fiberPoolRecycled;
+        return stats;
     }
 
     void Scheduler::start()
@@ -121,6 +454,32 @@ namespace sylar
         }
         SYLAR_LOG_INFO(g_logger) << "Scheduler::start() end thread num :" << m_threadIds.size();
         lock.unlock();
+        setRunning(true);
+    }
+
+    void Scheduler::setRunning(bool running)
+    {
+        Rcu::SetRetireHook(&Scheduler::OnRcuRetire);
+        Mutex::Lock lock(RunningMutex());
+        std::vector<Scheduler *> &schedulers = RunningSchedulers();
+        auto it = std::find(schedulers.begin(), schedulers.end(), this);
+        if (running && it == schedulers.end())
+        {
+            schedulers.push_back(this);
+        }
+        else if (!running && it != schedulers.end())
+        {
+            schedulers.erase(it);
+        }
+    }
+
+    void Scheduler::OnRcuRetire()
+    {
+        Mutex::Lock lock(RunningMutex());
+        for (auto i : RunningSchedulers())
+        {
+            i->tickleIdle(1);
+        }
     }
 
     void Scheduler::stop()
@@ -133,6 +492,7 @@ namespace sylar
 
             if (stopping())
             {
+                setRunning(false);
                 return;
             }
         }
@@ -182,12 +542,64 @@ namespace sylar
             // 阻塞等待所有线程执行完毕，才能停止
             i->join();
         }
+        // 在子类析构(如IOManager关闭tickle管道)之前移出
+        setRunning(false);
     }
 
     void Scheduler::tickle()
     {
-        // 通知协程调度有任务了
-        SYLAR_LOG_INFO(g_logger) << "tickle";
+        // 通知协程调度有任务了,有线程睡眠时唤醒一个
+        m_idleSeq.fetch_add(1, std::memory_order_seq_cst);
+        if (m_idleWaiters.load(std::memory_order_seq_cst))
+        {
+            syscall(SYS_futex, (uint32_t *)&m_idleSeq, FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+        }
+    }
+
+    void Scheduler::tickleIdle(size_t count)
+    {
+        // 只唤醒需要数量的睡眠线程,正在自旋的线程看到事件计数变化后自己回到调度循环
+        m_idleSeq.fetch_add(1, std::memory_order_seq_cst);
+        uint32_t waiters = m_idleWaiters.load(std::memory_order_seq_cst);
+        if (waiters)
+        {
+            int n = (int)std::min<size_t>(count, waiters);
+            syscall(SYS_futex, (uint32_t *)&m_idleSeq, FUTEX_WAKE_PRIVATE, n, nullptr, nullptr, 0);
+        }
+    }
+
+    FiberFuture<void> Scheduler::scheduleFuture(Fiber::ptr fiber, int thread, Priority priority)
+    {
+        SYLAR_ASSERT(fiber && fiber->getState() == Fiber::INIT && fiber->m_cb);
+        FutureState<void>::ptr state(new FutureState<void>);
+        // 包装协程的函数,结束时写入结果,不用重新创建协程
+        fiber->m_cb = Task([state, cb = std::move(fiber->m_cb)]() mutable
+                           { RunFuture(*state, cb); });
+        schedule(std::move(fiber), thread, priority);
+        return FiberFuture<void>(state);
+    }
+
+    void Scheduler::scheduleBatch(std::vector<Task> tasks, const std::vector<int> &threads, Priority priority)
+    {
+        SYLAR_ASSERT(threads.empty() || threads.size() == tasks.size());
+        size_t count = 0;
+        {
+            MutexType::Lock lock(m_mutex);
+            for (size_t i = 0; i < tasks.size(); ++i)
+            {
+                if (!tasks[i])
+                {
+                    continue;
+                }
+                FiberAndThread ft(&tasks[i], threads.empty() ? -1 : threads[i]);
+                enqueueNoLock(ft, priority);
+                ++count;
+            }
+        }
+        if (count)
+        {
+            tickleIdle(count);
+        }
     }
 
     void Scheduler::setThis()
@@ -207,6 +619,9 @@ namespace sylar
         // set_hook_enable(true);
 
         setThis(); // t_scheduler = this;
+        t_deadline_index = m_workerSeq.fetch_add(1) % m_deadlineQueues.size();
+        // 调度期间每次循环都是RCU静止点,写者不需要同步等待
+        Rcu::SetQuiescentThread(true);
 
         if (sylar::GetThreadId() != m_rootThread)
         {
@@ -220,7 +635,7 @@ namespace sylar
         // 没有任务时执行的协程
         Fiber::ptr idle_fiber(new Fiber(std::bind(&Scheduler::idle, this)));
 
-        if (m_fibers.empty())
+        if (m_taskCount == 0)
         {
             SYLAR_LOG_DEBUG(g_logger) << "run(): m_fiber is null";
         }
@@ -231,47 +646,137 @@ namespace sylar
         // }
 
         Fiber::ptr cb_fiber;
+        // 本线程的协程池,缓存已结束的协程,函数任务让出后不用再分配新的协程栈
+        std::vector<Fiber::ptr> fiber_pool;
+        // 已结束且没有其他引用的协程放入协程池
+        auto recycle = [this, &fiber_pool](Fiber::ptr &fiber)
+        {
+            if (fiber.use_count() == 1 && fiber_pool.size() < m_fiberPoolSize &&
+                fiber->getStackSize() == Fiber::GetDefaultStackSize())
+            {
+                fiber->reset(nullptr);
+                fiber_pool.push_back(std::move(fiber));
+                ++m_fiberPoolRecycled;
+            }
+            fiber.reset();
+        };
         FiberAndThread ft;
         // 此时已经在当前线程的主协程上了
         while (true)
         {
             // 一直循环调度
             // SYLAR_LOG_DEBUG(g_logger) << "enter while";
+            // 两个任务之间不在任何RCU读临界区中,推进RCU的延迟释放
+            Rcu::QuiescentPoint();
+            // 先记下事件计数再查找任务,查找之后的tickle都会让idle不睡眠
+            t_idle_key = m_idleSeq.load(std::memory_order_seq_cst);
             ft.reset();
             bool tickle_me = false; // 标注是否还有任务未执行
             bool is_active = false; // 标记是否找到任务放入线程中执行
+            // 截止时间任务先于各优先级队列
+            if (m_deadlineCount.load(std::memory_order_acquire) && popDeadline(ft))
+            {
+                if (ft.fiber && ft.fiber->getState() == Fiber::EXEC)
+                {
+                    // 协程在其他线程让出之前就被重新调度了,放回堆中等它让出
+                    pushDeadline(ft, true);
+                    ft.reset();
+                    --m_activeThreadCount;
+                    tickle_me = true;
+                }
+                else
+                {
+                    is_active = true;
+                    tickle_me = m_deadlineCount.load(std::memory_order_relaxed) > 0;
+                }
+            }
             // 从协程的消息队列里取出一个协程赋给ft
+            if (!is_active)
             {
                 MutexType::Lock lock(m_mutex);
-                auto it = m_fibers.begin();
-                // 循环遍历所有协程
-                while (it != m_fibers.end())
+                // 按有效优先级依次查找各个队列
+                int order[PRIORITY_COUNT];
+                queueOrder(order);
+                for (int k = 0; k < PRIORITY_COUNT && !is_active; ++k)
                 {
-                    if (it->thread != -1 && it->thread != sylar::GetThreadId())
-                    {
-                        // 该协程所在线程id!=-1(未使用caller进行协程调度) && 当前线程 != 该协程所在线程
-                        // 自己不能处理要交给其他线程处理
-                        ++it; // 向下遍历下一个协程
-                        tickle_me = true;
-                        continue;
-                    }
-
-                    SYLAR_ASSERT(it->fiber || it->cb);
-                    // fiber正在执行状态,无须执行
-                    if (it->fiber && it->fiber->getState() == Fiber::EXEC)
+                    // 函数队列和协程队列按入队序号合并遍历,保持先进先出
+                    std::list<FiberAndThread> &fibers = m_fibers[order[k]];
+                    FiberQueue &ready = m_readyFibers[order[k]];
+                    auto it = fibers.begin();
+                    Fiber *prev = nullptr;
+                    Fiber *f = ready.head;
+                    while (it != fibers.end() || f)
                     {
-                        ++it;
-                        continue;
+                        bool is_fiber = f && (it == fibers.end() || f->m_queueSeq < it->seq);
+                        int thread = is_fiber ? f->m_queueThread : it->thread;
+                        if (thread != -1 && thread != sylar::GetThreadId())
+                        {
+                            // 该协程所在线程id!=-1(未使用caller进行协程调度) && 当前线程 != 该协程所在线程
+                            // 自己不能处理要交给其他线程处理,向下遍历下一个
+                            if (is_fiber)
+                            {
+                                prev = f;
+                                f = f->m_queueNext;
+                            }
+                            else
+                            {
+                                ++it;
+                            }
+                            tickle_me = true;
+                            continue;
+                        }
+
+                        if (is_fiber)
+                        {
+                            // fiber正在执行状态,无须执行
+                            if (f->getState() == Fiber::EXEC)
+                            {
+                                prev = f;
+                                f = f->m_queueNext;
+                                continue;
+                            }
+                            // 从侵入式队列中摘下,接管队列持有的引用
+                            Fiber *next = f->m_queueNext;
+                            (prev ? prev->m_queueNext : ready.head) = next;
+                            if (ready.tail == f)
+                            {
+                                ready.tail = prev;
+                            }
+                            f->m_queueNext = nullptr;
+                            f->m_queued = false;
+                            ft.fiber = Fiber::ptr(f, false);
+                            ft.thread = f->m_queueThread;
+                            ft.priority = (Priority)f->m_queuePriority;
+                            ft.enqueueMs = f->m_enqueueMs;
+                            f = next;
+                        }
+                        else
+                        {
+                            SYLAR_ASSERT(it->cb);
+                            // 获取该函数赋给ft,并在函数队列中移除元素it
+                            ft = std::move(*it);
+                            fibers.erase(it++);
+                        }
+                        --m_taskCount;
+                        // 其他优先级队列中可能还有任务,也要唤醒其他线程
+                        tickle_me |= m_taskCount > 0;
+                        --m_queueStats[ft.priority].depth;
+                        for (int i = 0; i < ft.priority; ++i)
+                        {
+                            if (!queueEmpty(i))
+                            {
+                                // 还有更高优先级的任务在等待
+                                ++m_queueStats[ft.priority].aged;
+                                break;
+                            }
+                        }
+                        ++m_activeThreadCount; // 活跃线程数量+1
+                        is_active = true;
+                        // 找到一个可以执行的协程，则退出
+                        break;
                     }
-                    // 获取该协程赋给ft,并在协程处理队列m_fibers中移除元素it
-                    ft = *it;
-                    m_fibers.erase(it++);
-                    ++m_activeThreadCount; // 活跃线程数量+1
-                    is_active = true;
-                    // 找到一个可以执行的协程，则退出
-                    break;
+                    tickle_me |= it != fibers.end() || f;
                 }
-                tickle_me |= it != m_fibers.end();
             }
 
             if (tickle_me)
@@ -289,6 +794,7 @@ namespace sylar
 
                 // 执行的是fiber，然后该fiber为结束&&未出现异常
                 // 唤醒该协程，进行执行(与t_scheduler_fiber进行切换)
+                ft.fiber->m_deadlineMs = ft.deadlineMs;
                 ft.fiber->swapIn();
                 // 执行swapOut后才能回到这里，活跃线程数-1
                 --m_activeThreadCount;
@@ -296,8 +802,8 @@ namespace sylar
                 // 执行完成后
                 if (ft.fiber->getState() == Fiber::READY)
                 {
-                    // 未执行结束，还要去执行,则调用schedule方法将该协程重新放入协程队列m_fibers中
-                    schedule(ft.fiber);
+                    // 未执行结束，还要去执行,则调用schedule方法将该协程按原来的优先级(或截止时间)重新放入队列中
+                    reschedule(std::move(ft.fiber), ft.priority, ft.deadlineMs);
                 }
                 else if (ft.fiber->getState() != Fiber::TERM &&
                          ft.fiber->getState() != Fiber::EXCEPT)
@@ -305,25 +811,40 @@ namespace sylar
                     // 让出执行事件,进入hold状态
                     ft.fiber->setState(Fiber::HOLD);
                 }
+                else
+                {
+                    // 执行结束,回收到协程池
+                    recycle(ft.fiber);
+                }
             }
             else if (ft.cb) // 可执行体为函数
             {
                 // SYLAR_LOG_DEBUG(g_logger) << "ft.cb is not nullptr";
 
                 // 执行函数
+                if (!cb_fiber && !fiber_pool.empty())
+                {
+                    // 上一个函数协程让出了,从协程池中取一个已结束的协程
+                    cb_fiber = std::move(fiber_pool.back());
+                    fiber_pool.pop_back();
+                }
                 if (cb_fiber)
                 {
                     // 重置线程，用于复用，状态设为INIT
-                    cb_fiber->reset(ft.cb);
+                    cb_fiber->reset(std::move(ft.cb));
+                    ++m_fiberPoolHit;
                 }
                 else
                 {
-                    cb_fiber.reset(new Fiber(ft.cb));
+                    cb_fiber.reset(new Fiber(std::move(ft.cb)));
+                    ++m_fiberPoolMiss;
                 }
 
                 // cb_fiber中存放的是要执行的方法
-
+                Priority priority = ft.priority;
+                uint64_t deadline = ft.deadlineMs;
                 ft.reset();
+                cb_fiber->m_deadlineMs = deadline;
                 cb_fiber->swapIn(); // 切换到cb_fiber执行
                 // 执行结束或者swapOut才会回到这里，活跃线程数-1
                 --m_activeThreadCount;
@@ -331,8 +852,7 @@ namespace sylar
                 if (cb_fiber->getState() == Fiber::READY)
                 {
                     // 未执行完毕，重新加入到任务队列中
-                    schedule(cb_fiber);
-                    cb_fiber.reset();
+                    reschedule(std::move(cb_fiber), priority, deadline);
                 }
                 else if (cb_fiber->getState() == Fiber::EXCEPT || cb_fiber->getState() == Fiber::TERM)
                 {
@@ -373,6 +893,24 @@ namespace sylar
                 }
             }
         }
+        // use_caller时调度结束后调用线程不再经过静止点
+        Rcu::SetQuiescentThread(false);
+    }
+
+    void Scheduler::reschedule(Fiber::ptr fiber, Priority priority, uint64_t deadline_ms)
+    {
+        if (deadline_ms)
+        {
+            FiberAndThread ft(std::move(fiber), -1);
+            ft.deadlineMs = deadline_ms;
+            ft.enqueueMs = NowMs();
+            pushDeadline(ft, true);
+            tickle();
+        }
+        else
+        {
+            schedule(std::move(fiber), -1, priority);
+        }
     }
 
     void Scheduler::switchTo(int thread)
@@ -395,8 +933,17 @@ namespace sylar
            << " size=" << m_threadCount
            << " active_count=" << m_activeThreadCount
            << " idle_count=" << m_idleThreadCount
-           << " stopping=" << m_stopping
-           << " ]" << std::endl
+           << " stopping=" << m_stopping;
+        {
+            MutexType::Lock lock(m_mutex);
+            os << " queue_depth=";
+            for (int i = 0; i < PRIORITY_COUNT; ++i)
+            {
+                os << (i ? "/" : "") << m_queueStats[i].depth;
+            }
+        }
+        os << " deadline_depth=" << m_deadlineCount;
+        os << " ]" << std::endl
            << "    ";
         for (size_t i = 0; i < m_threadIds.size(); ++i)
         {
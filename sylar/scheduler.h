@@ -5,9 +5,12 @@
 #include <list>
 #include <vector>
 #include <atomic>
+#include <functional>
 #include "mutex.h"
 #include "fiber.h"
 #include "thread.h"
+#include "task.h"
+#include "fiber_future.h"
 
 namespace sylar
 {
@@ -23,6 +26,61 @@ namespace sylar
         typedef std::shared_ptr<Scheduler> ptr;
         typedef Mutex MutexType;
 
+        /**
+         * @brief 任务优先级,数值越小越优先,每个优先级一个队列
+         * 低优先级任务等待时间越长,有效优先级越高,不会被饿死
+         */
+        enum Priority
+        {
+            PRIORITY_HIGH = 0,   // 控制面、健康检查等延迟敏感的任务
+            PRIORITY_NORMAL = 1, // 默认优先级
+            PRIORITY_LOW = 2,    // 后台任务
+            PRIORITY_COUNT = 3
+        };
+
+        /**
+         * @brief 每个优先级队列的统计
+         */
+        struct QueueStats
+        {
+            size_t depth = 0;      // 当前队列中的任务数
+            size_t maxDepth = 0;   // 队列最大深度
+            uint64_t scheduled = 0; // 累计加入的任务数
+            uint64_t aged = 0;      // 因等待时间过长,先于更高优先级任务执行的次数
+        };
+
+        /**
+         * @brief 协程池统计,每个调度线程缓存已结束的协程(连同协程栈)用于执行函数任务
+         */
+        struct FiberPoolStats
+        {
+            uint64_t hit = 0;      // 复用已结束的协程执行函数的次数
+            uint64_t miss = 0;     // 新建协程(分配协程栈)的次数
+            uint64_t recycled = 0; // 结束后放入协程池的协程数
+        };
+
+        /**
+         * @brief 截止时间已过、还未开始执行的任务的处理策略
+         */
+        enum DeadlinePolicy
+        {
+            DEADLINE_RUN = 0,     // 照常执行
+            DEADLINE_DROP = 1,    // 丢弃
+            DEADLINE_CALLBACK = 2 // 丢弃,改为执行任务的on_miss回调
+        };
+
+        /**
+         * @brief 截止时间任务的统计
+         */
+        struct DeadlineStats
+        {
+            uint64_t scheduled = 0; // 累计加入的任务数
+            uint64_t met = 0;       // 在截止时间之前开始执行的任务数
+            uint64_t missed = 0;    // 开始执行时已超过截止时间的任务数
+            uint64_t shed = 0;      // 超时后被丢弃或改为执行回调的任务数
+            uint64_t stolen = 0;    // 从其他线程的堆中取走的任务数
+        };
+
         /**
          * @brief 构造函数
          *
@@ -72,18 +130,22 @@ namespace sylar
 
         /**
          * @brief 调度协程
+         * 队列需要持有协程的一个引用:传入右值Fiber::ptr(std::move)或Fiber::ptr*时队列接管这个引用,
+         * 不修改引用计数;传入左值Fiber::ptr会复制一次(引用计数加1),
+         * Fiber::GetThis()返回的是新增的引用,直接传入同样不再额外修改
          *
          * @tparam FiberOrCb
          * @param fc 协程或函数
          * @param thread 协程执行的线程id,-1标识任意线程
+         * @param priority 优先级
          */
         template <class FiberOrCb>
-        void schedule(FiberOrCb fc, int thread = -1)
+        void schedule(FiberOrCb fc, int thread = -1, Priority priority = PRIORITY_NORMAL)
         {
             bool need_tickle = false;
             {
                 MutexType::Lock lock(m_mutex);
-                need_tickle = scheduleNoLock(fc, thread);
+                need_tickle = scheduleNoLock(std::move(fc), thread, priority);
             }
 
             if (need_tickle)
@@ -94,6 +156,8 @@ namespace sylar
 
         /**
          * @brief 批量调度协程
+         * 复制每个元素加入队列,不修改调用者的容器,空的协程或函数跳过;
+         * 只能移动的Task请用scheduleBatch
          *
          * @tparam InputIterator
          * @param begin 协程数组开始位置
@@ -102,25 +166,139 @@ namespace sylar
         template <class InputIterator>
         void schedule(InputIterator begin, InputIterator end)
         {
-            bool need_tickle = false;
+            size_t count = 0;
             {
                 MutexType::Lock lock(m_mutex);
                 // 遍历
-                while (begin != end)
+                for (; begin != end; ++begin)
                 {
-                    need_tickle = scheduleNoLock(&*begin, -1) || need_tickle;
-                    ++begin;
+                    const auto &item = *begin;
+                    FiberAndThread ft(item, -1);
+                    if (ft.fiber || ft.cb)
+                    {
+                        enqueueNoLock(ft, PRIORITY_NORMAL);
+                        ++count;
+                    }
                 }
             }
-            if (need_tickle)
+            if (count)
             {
-                tickle();
+                tickleIdle(count);
             }
         }
 
+        /**
+         * @brief 调度函数并返回结果
+         * 在协程中等待结果(get/wait/WhenAll/WhenAny)时只挂起协程,不阻塞线程;
+         * 函数抛出的异常保存在FiberFuture中,get()时重新抛出
+         *
+         * @tparam F 无参数的函数
+         * @param f 函数
+         * @param thread 执行的线程id,-1标识任意线程
+         * @param priority 优先级
+         * @return FiberFuture<F的返回值类型>
+         */
+        template <class F, class R = typename std::invoke_result<F &>::type>
+        FiberFuture<R> scheduleFuture(F f, int thread = -1, Priority priority = PRIORITY_NORMAL)
+        {
+            typename FutureState<R>::ptr state(new FutureState<R>);
+            schedule(Task([state, f = std::move(f)]() mutable
+                          { RunFuture(*state, f); }),
+                     thread, priority);
+            return FiberFuture<R>(state);
+        }
+
+        /**
+         * @brief 调度已创建的协程并返回它的结果,用于等待(join)该协程结束
+         * 协程需要还未开始执行(INIT状态),它的函数抛出的异常在get()时重新抛出
+         *
+         * @param fiber 协程
+         * @param thread 执行的线程id,-1标识任意线程
+         * @param priority 优先级
+         */
+        FiberFuture<void> scheduleFuture(Fiber::ptr fiber, int thread = -1, Priority priority = PRIORITY_NORMAL);
+
+        /**
+         * @brief 批量调度函数,一次加锁放入队列,只唤醒需要数量的空闲线程
+         * 任务放入共享的优先级队列,空闲线程被唤醒后各自取任务,相当于在线程之间轮流分配
+         *
+         * @param tasks 函数数组,任务被移走
+         * @param threads 每个任务指定执行的线程id,-1标识任意线程;为空表示全部为任意线程
+         * @param priority 优先级
+         */
+        void scheduleBatch(std::vector<Task> tasks, const std::vector<int> &threads = {},
+                           Priority priority = PRIORITY_NORMAL);
+
+        /**
+         * @brief 按截止时间调度(EDF),截止时间最早的任务最先执行,先于各优先级队列
+         * 任务放入当前线程(调度线程之外则轮流选择)的截止时间堆,
+         * 线程从所有堆中选择截止时间最早的任务,其他线程的任务更早时从它的堆中取走
+         *
+         * @tparam FiberOrCb
+         * @param fc 协程或函数
+         * @param deadline_ms 截止时间,NowMs()时钟的毫秒数
+         * @param on_miss 超时策略为DEADLINE_CALLBACK时代替任务执行的回调
+         */
+        template <class FiberOrCb>
+        void scheduleWithDeadline(FiberOrCb fc, uint64_t deadline_ms, Task on_miss = nullptr)
+        {
+            FiberAndThread ft(std::move(fc), -1);
+            if (!ft.fiber && !ft.cb)
+            {
+                return;
+            }
+            ft.deadlineMs = deadline_ms;
+            ft.onMiss = std::move(on_miss);
+            ft.enqueueMs = NowMs();
+            pushDeadline(ft, false);
+            tickle();
+        }
+
+        /**
+         * @brief 设置截止时间已过的任务的处理策略,默认为配置scheduler.deadline_policy
+         */
+        void setDeadlinePolicy(DeadlinePolicy policy) { m_deadlinePolicy = policy; }
+
+        /**
+         * @brief 返回截止时间任务的统计
+         */
+        DeadlineStats getDeadlineStats();
+
+        /**
+         * @brief 粗粒度的单调时间,毫秒,scheduleWithDeadline的截止时间使用该时钟
+         */
+        static uint64_t NowMs();
+
         void switchTo(int thread = -1);
         std::ostream &dump(std::ostream &os);
 
+        /**
+         * @brief 设置空闲线程睡眠前自旋等待的时间
+         * @param us 微秒,0表示不自旋直接睡眠,默认为配置scheduler.idle_spin_us
+         */
+        void setIdleSpin(uint32_t us) { m_idleSpinUs = us; }
+
+        /**
+         * @brief 设置老化时间,低一级的任务多等待ms毫秒后与高一级的任务同等对待
+         * 默认为配置scheduler.aging_ms
+         */
+        void setAging(uint32_t ms) { m_agingMs = ms; }
+
+        /**
+         * @brief 返回优先级priority的队列统计
+         */
+        QueueStats getQueueStats(Priority priority);
+
+        /**
+         * @brief 设置每个调度线程的协程池大小,0表示不缓存,默认为配置scheduler.fiber_pool_size
+         */
+        void setFiberPoolSize(uint32_t size) { m_fiberPoolSize = size; }
+
+        /**
+         * @brief 返回协程池统计
+         */
+        FiberPoolStats getFiberPoolStats();
+
     protected:
         /**
          * @brief 通知协程调度有任务了
@@ -128,6 +306,11 @@ namespace sylar
          */
         virtual void tickle();
 
+        /**
+         * @brief 新加入了count个任务,唤醒最多count个空闲线程
+         */
+        virtual void tickleIdle(size_t count);
+
         /**
          * @brief 协程调度函数
          *
@@ -176,18 +359,66 @@ namespace sylar
          * @return false
          */
         template <class FiberOrCb>
-        bool scheduleNoLock(FiberOrCb fc, int thread)
+        bool scheduleNoLock(FiberOrCb fc, int thread, Priority priority)
         {
-            bool need_tickle = m_fibers.empty();
-            FiberAndThread ft(fc, thread);
+            bool need_tickle = m_taskCount == 0;
+            FiberAndThread ft(std::move(fc), thread);
             if (ft.fiber || ft.cb)
             {
                 // 要么是协程，要么是函数指针
-                m_fibers.push_back(ft);
+                need_tickle |= enqueueNoLock(ft, priority);
             }
             return need_tickle;
         }
 
+        struct FiberAndThread;
+
+        /**
+         * @brief 任务放入优先级队列,需要持有m_mutex
+         * 协程直接链接到侵入式队列(接管ft中的引用,不修改引用计数),函数放入函数队列;
+         * 截止时间任务的协程让出后重新调度时放回截止时间堆;已经在队列中的协程不能再次加入(断言)
+         * @return 是否放入了截止时间堆(需要唤醒线程)
+         */
+        bool enqueueNoLock(FiberAndThread &ft, Priority priority);
+
+        /**
+         * @brief 优先级队列是否为空(协程队列和函数队列都为空),需要持有m_mutex
+         */
+        bool queueEmpty(int priority) const;
+
+        /**
+         * @brief 按有效优先级排列查找任务的队列顺序,需要持有m_mutex
+         * 有效优先级 = 优先级 * 老化时间 - 队首任务已等待的时间
+         */
+        void queueOrder(int *order);
+
+        /**
+         * @brief 把截止时间任务放入堆中
+         * @param started 任务是否已经开始执行过(让出后重新加入),开始过的任务不再判断超时
+         */
+        void pushDeadline(FiberAndThread &ft, bool started);
+
+        /**
+         * @brief 取出截止时间最早的任务,超时的任务按策略处理
+         * @return 是否取到可以执行的任务
+         */
+        bool popDeadline(FiberAndThread &ft);
+
+        /**
+         * @brief 让出执行的任务重新加入,截止时间任务回到截止时间堆,其他任务回到原优先级队列
+         */
+        void reschedule(Fiber::ptr fiber, Priority priority, uint64_t deadline_ms);
+
+        /**
+         * @brief 加入/移出运行中的调度器列表
+         */
+        void setRunning(bool running);
+
+        /**
+         * @brief RCU有新的待释放对象时唤醒所有运行中调度器的一个空闲线程
+         */
+        static void OnRcuRetire();
+
     private:
         /**
          * @brief 协程/函数/线程组
@@ -195,9 +426,15 @@ namespace sylar
          */
         struct FiberAndThread
         {
-            Fiber::ptr fiber;         // 协程
-            std::function<void()> cb; // 协程执行函数
-            int thread;               // 线程id
+            Fiber::ptr fiber;                   // 协程
+            Task cb;                            // 协程执行函数,只移动不复制
+            int thread;                         // 线程id
+            Priority priority = PRIORITY_NORMAL; // 优先级
+            uint64_t enqueueMs = 0;             // 加入队列的时间
+            uint64_t seq = 0;                   // 入队序号,与协程队列合并时保持先进先出
+            uint64_t deadlineMs = 0;            // 截止时间,0表示不是截止时间任务
+            bool started = false;               // 截止时间任务是否已经开始执行过
+            Task onMiss;                        // 超时时代替任务执行的回调
 
             /**
              * @brief Construct a new Fiber And Thread object
@@ -206,7 +443,7 @@ namespace sylar
              * @param thr
              */
             FiberAndThread(Fiber::ptr f, int thr)
-                : fiber(f), thread(thr)
+                : fiber(std::move(f)), thread(thr)
             {
             }
 
@@ -222,15 +459,23 @@ namespace sylar
                 fiber.swap(*f);
             }
 
-            FiberAndThread(std::function<void()> f, int thr)
-                : cb(f), thread(thr)
+            FiberAndThread(Task f, int thr)
+                : cb(std::move(f)), thread(thr)
+            {
+            }
+
+            FiberAndThread(Task *f, int thr)
+                : cb(std::move(*f)), thread(thr)
             {
             }
 
+            /**
+             * @brief 传入函数的指针,取走函数,原函数置空
+             */
             FiberAndThread(std::function<void()> *f, int thr)
-                : thread(thr)
+                : cb(std::move(*f)), thread(thr)
             {
-                cb.swap(*f);
+                *f = nullptr;
             }
             // 默认构造函数
             FiberAndThread() : thread(-1)
@@ -246,13 +491,57 @@ namespace sylar
                 fiber = nullptr;
                 cb = nullptr;
                 thread = -1;
+                priority = PRIORITY_NORMAL;
+                enqueueMs = 0;
+                seq = 0;
+                deadlineMs = 0;
+                started = false;
+                onMiss = nullptr;
             }
         };
 
+        /**
+         * @brief 每个调度线程一个截止时间最小堆
+         */
+        struct DeadlineQueue
+        {
+            Mutex mutex;
+            std::vector<FiberAndThread> heap;            // 按截止时间排列的最小堆
+            std::atomic<uint64_t> top = {UINT64_MAX};    // 堆顶的截止时间,空堆为UINT64_MAX,无锁读取
+        };
+
+        /**
+         * @brief 侵入式协程队列,通过Fiber::m_queueNext链接,队列持有每个协程的一个引用
+         */
+        struct FiberQueue
+        {
+            Fiber *head = nullptr;
+            Fiber *tail = nullptr;
+        };
+
     private:
         MutexType m_mutex;                  // 锁
         std::vector<Thread::ptr> m_threads; // 线程池
-        std::list<FiberAndThread> m_fibers; // 待执行的任务队列(里面是一个个的协程)
+        std::list<FiberAndThread> m_fibers[PRIORITY_COUNT]; // 每个优先级一个待执行的函数队列
+        FiberQueue m_readyFibers[PRIORITY_COUNT];           // 每个优先级一个待执行的协程队列
+        uint64_t m_queueSeq = 0;                            // 入队序号
+        size_t m_taskCount = 0;                             // 所有队列中的任务总数
+        QueueStats m_queueStats[PRIORITY_COUNT];            // 每个优先级队列的统计
+        std::atomic<uint32_t> m_agingMs = {0};              // 老化时间,毫秒
+        std::vector<std::unique_ptr<DeadlineQueue>> m_deadlineQueues; // 每个调度线程一个截止时间堆
+        std::atomic<size_t> m_deadlineCount = {0};          // 所有截止时间堆中的任务总数
+        std::atomic<size_t> m_deadlineNext = {0};           // 调度线程之外加入任务时轮流选择堆
+        std::atomic<size_t> m_workerSeq = {0};              // 为调度线程分配堆的序号
+        std::atomic<int> m_deadlinePolicy = {DEADLINE_RUN}; // 超时任务的处理策略
+        std::atomic<uint64_t> m_deadlineScheduled = {0};    // 截止时间任务的统计,见DeadlineStats
+        std::atomic<uint64_t> m_deadlineMet = {0};
+        std::atomic<uint64_t> m_deadlineMissed = {0};
+        std::atomic<uint64_t> m_deadlineShed = {0};
+        std::atomic<uint64_t> m_deadlineStolen = {0};
+        std::atomic<uint32_t> m_fiberPoolSize = {0};        // 每个调度线程的协程池大小
+        std::atomic<uint64_t> m_fiberPoolHit = {0};         // 协程池统计,见FiberPoolStats
+        std::atomic<uint64_t> m_fiberPoolMiss = {0};
+        std::atomic<uint64_t> m_fiberPoolRecycled = {0};
         std::string m_name;                 // 协程调度器名称
         // 为caller线程设计的变量
         Fiber::ptr m_rootFiber; // use_caller=true时，该值为caller线程的调度协程
@@ -262,6 +551,9 @@ namespace sylar
         size_t m_threadCount = 0;                      // 线程数量
         std::atomic<size_t> m_activeThreadCount = {0}; // 活跃线程数量（正在干任务的线程数量）
         std::atomic<size_t> m_idleThreadCount = {0};   // 空闲线程数量
+        std::atomic<uint32_t> m_idleSeq = {0};         // 事件计数,每次tickle加1,空闲线程在上面futex等待
+        std::atomic<uint32_t> m_idleWaiters = {0};     // 在futex上睡眠的线程数量
+        std::atomic<uint32_t> m_idleSpinUs = {0};      // 睡眠前自旋的时间,微秒
         bool m_stopping = true;                        // 是否正在停止
         bool m_autoStop = false;                       // 是否主动停止
         // 为caller线程设计的变量
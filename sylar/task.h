@@ -0,0 +1,176 @@
+#ifndef __SYLAR_TASK_H__
+#define __SYLAR_TASK_H__
+
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace sylar
+{
+    /**
+     * @brief 只能移动的任务(可调用对象)
+     * 不超过64字节、移动不抛异常的可调用对象直接保存在内部缓冲区中,不申请内存,
+     * 更大的对象才在堆上分配;从schedule()到协程执行全程移动,不会复制
+     * 用来代替std::function<void()>(捕获超过16字节就会申请内存,且只能复制)
+     */
+    class Task
+    {
+    public:
+        static constexpr size_t INLINE_SIZE = 64; // 内部缓冲区大小
+
+        Task() noexcept {}
+        Task(std::nullptr_t) noexcept {}
+
+        /**
+         * @brief 从可调用对象构造
+         * 空的函数指针、std::function构造出空任务
+         */
+        template <class F, class D = typename std::decay<F>::type,
+                  class = typename std::enable_if<!std::is_same<D, Task>::value &&
+                                                  std::is_invocable<D &>::value>::type>
+        Task(F &&f)
+        {
+            if constexpr (std::is_pointer<D>::value ||
+                          (std::is_class<D>::value && std::is_constructible<bool, const D &>::value &&
+                           !std::is_convertible<const D &, void (*)()>::value))
+            {
+                if (!static_cast<bool>(f))
+                {
+                    return;
+                }
+            }
+            if constexpr (IsInline<D>())
+            {
+                new (&m_buf) D(std::forward<F>(f));
+                m_ops = &InlineOps<D>::s_ops;
+            }
+            else
+            {
+                *reinterpret_cast<D **>(&m_buf) = new D(std::forward<F>(f));
+                m_ops = &HeapOps<D>::s_ops;
+            }
+        }
+
+        Task(Task &&other) noexcept
+        {
+            moveFrom(other);
+        }
+
+        Task &operator=(Task &&other) noexcept
+        {
+            if (this != &other)
+            {
+                clear();
+                moveFrom(other);
+            }
+            return *this;
+        }
+
+        Task &operator=(std::nullptr_t) noexcept
+        {
+            clear();
+            return *this;
+        }
+
+        Task(const Task &) = delete;
+        Task &operator=(const Task &) = delete;
+
+        ~Task()
+        {
+            clear();
+        }
+
+        void swap(Task &other) noexcept
+        {
+            Task tmp(std::move(other));
+            other = std::move(*this);
+            *this = std::move(tmp);
+        }
+
+        explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+        void operator()()
+        {
+            m_ops->invoke(&m_buf);
+        }
+
+        /**
+         * @brief 可调用对象是否在堆上分配(超过内部缓冲区)
+         */
+        bool isHeap() const { return m_ops && m_ops->heap; }
+
+    private:
+        /**
+         * @brief 类型擦除的操作表,每种可调用类型一份静态实例
+         */
+        struct Ops
+        {
+            void (*invoke)(void *buf);
+            void (*move)(void *dst, void *src) noexcept; // 移动到dst并析构src
+            void (*destroy)(void *buf) noexcept;
+            bool heap;
+        };
+
+        typedef typename std::aligned_storage<INLINE_SIZE, alignof(std::max_align_t)>::type Storage;
+
+        template <class D>
+        static constexpr bool IsInline()
+        {
+            return sizeof(D) <= INLINE_SIZE && alignof(std::max_align_t) % alignof(D) == 0 &&
+                   std::is_nothrow_move_constructible<D>::value;
+        }
+
+        template <class D>
+        struct InlineOps
+        {
+            static void Invoke(void *buf) { (*static_cast<D *>(buf))(); }
+            static void Move(void *dst, void *src) noexcept
+            {
+                new (dst) D(std::move(*static_cast<D *>(src)));
+                static_cast<D *>(src)->~D();
+            }
+            static void Destroy(void *buf) noexcept { static_cast<D *>(buf)->~D(); }
+            static constexpr Ops s_ops = {&Invoke, &Move, &Destroy, false};
+        };
+
+        template <class D>
+        struct HeapOps
+        {
+            static void Invoke(void *buf) { (**static_cast<D **>(buf))(); }
+            static void Move(void *dst, void *src) noexcept
+            {
+                *static_cast<D **>(dst) = *static_cast<D **>(src);
+            }
+            static void Destroy(void *buf) noexcept { delete *static_cast<D **>(buf); }
+            static constexpr Ops s_ops = {&Invoke, &Move, &Destroy, true};
+        };
+
+        void moveFrom(Task &other) noexcept
+        {
+            if (other.m_ops)
+            {
+                other.m_ops->move(&m_buf, &other.m_buf);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+
+        void clear() noexcept
+        {
+            if (m_ops)
+            {
+                const Ops *ops = m_ops;
+                m_ops = nullptr;
+                ops->destroy(&m_buf);
+            }
+        }
+
+    private:
+        Storage m_buf;              // 内部缓冲区,放不下时保存堆上对象的指针
+        const Ops *m_ops = nullptr; // 为空表示空任务
+    };
+
+}
+
+#endif
@@ -1,5 +1,6 @@
 #include "log.h"
 #include "log_socket.h"
+#include "iomanager.h"
 #include <iostream>
 #include <sys/ipc.h>
 #include <sys/shm.h>
@@ -18,8 +19,12 @@ void server_fun_1(char *socket_local_path)
     sylar::SocketLogAppender::ptr log_socket{new sylar::SocketLogAppender(socket_local_path)};
     logger->addAppender(log_socket);
 
-    // 开启服务，阻塞等待连接
-    log_socket->init();
+    // 开启服务，由IOManager接收连接并发送日志
+    sylar::IOManager iom(1, false, "log_socket");
+    if (!log_socket->init(&iom))
+    {
+        return;
+    }
 
     while (true)
     {
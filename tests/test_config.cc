@@ -1,8 +1,16 @@
 #include <string>
+#include <fstream>
+#include <chrono>
+#include <thread>
+#include <algorithm>
+#include <assert.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "config.h"
 #include "log.h"
 #include "util.h"
 #include "log_config.h"
+#include "scheduler.h"
 #include <yaml-cpp/yaml.h>
 
 void print_yaml(const YAML::Node &node, int level)
@@ -131,8 +139,9 @@ void test_list_to_string()
     // 从yaml文件加载到ConfigVarMap s_datas中
     sylar::Config::LoadFromYaml(root);
 
-    auto v = g_int_vec_value_config->getValue();
-    for (auto i : v)
+    // 只读快照,不拷贝整个list
+    auto v = g_int_vec_value_config->getSnapshot();
+    for (auto i : *v)
     {
         SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << i;
     }
@@ -319,8 +328,14 @@ void test_log()
     std::cout << sylar::LoggerMgr::GetInstance()->toYamlString() << std::endl;
 
     struct sylar::LogIniter log_init;
+    std::string conf_file = "/root/c_plus_plus_project/sylar/bin/conf/logs.yaml";
+    if (access(conf_file.c_str(), R_OK) != 0)
+    {
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << conf_file << " not found, skip test_log";
+        return;
+    }
     // 使用yaml-cpp加载yaml文件
-    YAML::Node root = YAML::LoadFile("/root/c_plus_plus_project/sylar/bin/conf/logs.yaml");
+    YAML::Node root = YAML::LoadFile(conf_file);
     // 加载yaml节点到Config中
     sylar::Config::LoadFromYaml(root);
 
@@ -341,6 +356,196 @@ void test_log()
     m_filestream.close();
 }
 
+void test_cache()
+{
+    sylar::ConfigVar<std::vector<int>>::ptr g_int_vec_value_config =
+        sylar::Config::Lookup("system.int_vec", std::vector<int>{1, 2}, "system int vec");
+    // 每个线程一份缓存,配置未变化时只比较一次版本号
+    static thread_local sylar::ConfigCache<std::vector<int>> s_int_vec(g_int_vec_value_config);
+    uint64_t generation = sylar::Config::GetGeneration();
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "before: size=" << s_int_vec->size()
+                                     << " generation=" << generation;
+    assert(s_int_vec->size() == 2);
+
+    g_int_vec_value_config->setValue(std::vector<int>{1, 2, 3, 4});
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "after: size=" << s_int_vec->size()
+                                     << " generation=" << sylar::Config::GetGeneration();
+    assert(sylar::Config::GetGeneration() > generation);
+    assert(s_int_vec->size() == 4);
+
+    // 其他线程修改后,本线程的缓存同样能看到新值
+    std::thread t([g_int_vec_value_config]()
+                  { g_int_vec_value_config->setValue(std::vector<int>{1}); });
+    t.join();
+    assert(s_int_vec->size() == 1);
+}
+
+void test_visit()
+{
+    sylar::Config::Lookup("system.port", (int)8080, "system port");
+    sylar::Config::Lookup("system.value", (float)10.2f, "system value");
+    sylar::Config::Lookup("systemx.value", (int)1, "not in system");
+    // 只遍历system下的配置项
+    std::vector<std::string> names;
+    sylar::Config::Visit("system.*", [&names](sylar::ConfigVarBase::ptr var)
+                         { SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "name=" << var->getName()
+                                                            << " description=" << var->getDescription()
+                                                            << " value=" << var->toString();
+                           names.push_back(var->getName()); });
+    // 按名称排序,不包含systemx
+    assert(std::is_sorted(names.begin(), names.end()));
+    assert(std::count(names.begin(), names.end(), "system.port") == 1);
+    assert(std::count(names.begin(), names.end(), "system.value") == 1);
+    assert(std::count(names.begin(), names.end(), "systemx.value") == 0);
+
+    // 其他线程注册的配置项,能查到之后遍历也一定能看到
+    const int count = 1000;
+    std::thread t([]()
+                  {
+                      for (int i = 0; i < count; ++i)
+                      {
+                          sylar::Config::Lookup("visit.key" + std::to_string(i), i, "visit key");
+                      } });
+    for (int i = 0; i < count; ++i)
+    {
+        std::string name = "visit.key" + std::to_string(i);
+        while (!sylar::Config::LookupBase(name))
+        {
+        }
+        bool found = false;
+        sylar::Config::Visit("visit", [&name, &found](sylar::ConfigVarBase::ptr var)
+                             { found |= var->getName() == name; });
+        assert(found);
+    }
+    t.join();
+}
+
+static constexpr const char *s_modes[] = {"fast", "safe"};
+static constexpr sylar::ConfigSchema s_port_schema = sylar::ConfigSchema().range(1, 65535).reloadable(false);
+static constexpr sylar::ConfigSchema s_mode_schema = sylar::ConfigSchema().oneOf(s_modes);
+
+void test_schema()
+{
+    auto port = sylar::Config::Lookup("schema.port", (int)8080, "schema port", s_port_schema);
+    auto mode = sylar::Config::Lookup("schema.mode", std::string("fast"), "schema mode", s_mode_schema);
+    static int s_changed = 0;
+    port->addListener([](const int &old_value, const int &new_value)
+                      { SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "port changed " << old_value << " -> " << new_value;
+                        ++s_changed; });
+
+    // 超出范围,拒绝修改,监听器不会执行
+    bool ok = port->setValue(70000);
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "set port 70000: " << ok << " port=" << port->getValue();
+    assert(!ok && port->getValue() == 8080 && s_changed == 0);
+    ok = mode->setValue("slow");
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "set mode slow: " << ok << " mode=" << mode->getValue();
+    assert(!ok && mode->getValue() == "fast");
+    assert(mode->setValue("safe") && mode->getValue() == "safe");
+
+    // 第一次加载生效,之后不允许重新加载
+    assert(port->fromString("9090"));
+    assert(!port->fromString("9091"));
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "port=" << port->getValue();
+    assert(port->getValue() == 9090 && s_changed == 1);
+
+    // 类型不同时查找失败,类型相同时返回已注册的配置项
+    assert(!sylar::Config::Lookup<std::string>("schema.port"));
+    assert(sylar::Config::Lookup<int>("schema.port") == port);
+}
+
+void test_snapshot()
+{
+    // 注册大量配置项,比较解析yaml和加载快照的耗时
+    YAML::Node root;
+    for (int i = 0; i < 20000; ++i)
+    {
+        std::string name = "snapshot.key" + std::to_string(i);
+        sylar::Config::Lookup(name, std::vector<int>{i}, "snapshot key");
+        root["snapshot"]["key" + std::to_string(i)].push_back(i + 1);
+    }
+    std::string dir = "/tmp/sylar_test_snapshot";
+    mkdir(dir.c_str(), 0755);
+    unlink((dir + "/zz_extra.yml").c_str());
+    std::ofstream ofs(dir + "/snapshot.yml");
+    ofs << root;
+    ofs.close();
+    std::string snapshot = dir + ".bin";
+    unlink(snapshot.c_str());
+
+    auto start = std::chrono::steady_clock::now();
+    // 第一次没有快照,加载yaml并生成快照
+    sylar::Config::LoadWithSnapshot(dir, snapshot);
+    auto mid = std::chrono::steady_clock::now();
+    // 之后直接加载快照
+    sylar::Config::LoadWithSnapshot(dir, snapshot);
+    auto end = std::chrono::steady_clock::now();
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "yaml cost "
+                                     << std::chrono::duration_cast<std::chrono::milliseconds>(mid - start).count()
+                                     << "ms, snapshot cost "
+                                     << std::chrono::duration_cast<std::chrono::milliseconds>(end - mid).count()
+                                     << "ms, key19999=" << sylar::Config::Lookup<std::vector<int>>("snapshot.key19999")->toString();
+    auto key0 = sylar::Config::Lookup<std::vector<int>>("snapshot.key0");
+    auto key1 = sylar::Config::Lookup<std::vector<int>>("snapshot.key1");
+    assert(sylar::Config::Lookup<std::vector<int>>("snapshot.key19999")->getValue() == std::vector<int>{20000});
+
+    // 快照中保存的是加载后的值
+    key0->setValue(std::vector<int>{-1});
+    assert(sylar::Config::LoadSnapshot(snapshot));
+    assert(key0->getValue() == std::vector<int>{1});
+
+    // 新增文件(按文件名顺序最后加载),快照过期,重新加载yaml
+    std::ofstream extra(dir + "/zz_extra.yml");
+    extra << "snapshot:\n  key1: [100]\n";
+    extra.close();
+    sylar::Config::LoadWithSnapshot(dir, snapshot);
+    assert(key1->getValue() == std::vector<int>{100});
+
+    // 删除文件后剩下的文件都比快照旧,只比较修改时间会误用快照
+    unlink((dir + "/zz_extra.yml").c_str());
+    sylar::Config::LoadWithSnapshot(dir, snapshot);
+    assert(key1->getValue() == std::vector<int>{2});
+}
+
+void test_listener_scheduler()
+{
+    auto var = sylar::Config::Lookup("system.listener", (int)0, "listener on scheduler");
+    static std::atomic<int> s_calls{0};
+    static std::atomic<int> s_last{0};
+    static std::atomic<pid_t> s_thread{0};
+    var->addListener([](const int &old_value, const int &new_value)
+                     {
+        // 模拟耗时的监听器,不会阻塞修改配置的线程
+        usleep(100 * 1000);
+        SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "listener " << old_value << " -> " << new_value;
+        s_thread = sylar::GetThreadId();
+        ++s_calls;
+        s_last = new_value; });
+
+    sylar::Scheduler sc(1, false, "listener");
+    sc.start();
+    var->setListenerScheduler(&sc);
+    // 连续修改,监听器只收到合并后的结果
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 1; i <= 100; ++i)
+    {
+        var->setValue(i);
+    }
+    auto cost = std::chrono::steady_clock::now() - start;
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "set done value=" << var->getValue();
+    // 在同一线程执行100次监听器至少需要10秒
+    assert(cost < std::chrono::seconds(1));
+    for (int i = 0; i < 100 && s_last != 100; ++i)
+    {
+        usleep(50 * 1000);
+    }
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "listener calls=" << s_calls;
+    assert(s_last == 100);
+    assert(s_calls < 100);
+    assert(s_thread != sylar::GetThreadId());
+    var->setListenerScheduler(nullptr);
+    sc.stop();
+}
+
 int main()
 {
     std::cout << "hello world" << std::endl;
@@ -380,6 +585,16 @@ int main()
 
     // test_class();
 
+    test_cache();
+
+    test_visit();
+
+    test_schema();
+
+    test_snapshot();
+
+    test_listener_scheduler();
+
     test_log();
 
     return 0;
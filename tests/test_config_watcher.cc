@@ -0,0 +1,61 @@
+#include <iostream>
+#include <fstream>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "config.h"
+#include "config_watcher.h"
+#include "log_config.h"
+
+/**
+ * @brief 配置目录热加载
+ * 修改目录中的yaml文件后，只重新加载变化的文件和配置项，未变化的appender不会重建
+ */
+
+static sylar::ConfigVar<int>::ptr g_port = sylar::Config::Lookup("server.port", (int)80, "server port");
+static sylar::ConfigVar<int>::ptr g_timeout = sylar::Config::Lookup("server.timeout", (int)1000, "server timeout");
+
+static void write_file(const std::string &file, const std::string &content)
+{
+    // 先写临时文件再重命名，与编辑器保存的方式相同
+    std::ofstream ofs(file + ".tmp");
+    ofs << content;
+    ofs.close();
+    rename((file + ".tmp").c_str(), file.c_str());
+}
+
+int main(int argc, char **argv)
+{
+    sylar::LogIniter log_init;
+    std::string dir = "/tmp/sylar_test_conf";
+    mkdir(dir.c_str(), 0755);
+    write_file(dir + "/server.yml", "server:\n  port: 8080\n  timeout: 3000\n");
+    write_file(dir + "/log.yml", "logs:\n  - name: test_watcher\n    level: info\n    appenders:\n"
+                                 "      - type: StdoutLogAppender\n");
+
+    g_port->addListener([](const int &old_value, const int &new_value)
+                        { SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "port changed " << old_value << " -> " << new_value; });
+    g_timeout->addListener([](const int &old_value, const int &new_value)
+                           { SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "timeout changed " << old_value << " -> " << new_value; });
+
+    sylar::IOManager iom(1, false, "watcher");
+    sylar::ConfigWatcher::ptr watcher(new sylar::ConfigWatcher(dir, &iom));
+    watcher->start();
+
+    auto logger = SYLAR_LOG_NAME("test_watcher");
+    auto appender = logger->getAppenders()->at(0);
+    SYLAR_LOG_INFO(logger) << "port=" << g_port->getValue() << " timeout=" << g_timeout->getValue();
+
+    // 只修改port,timeout的监听器不会触发
+    sleep(1);
+    write_file(dir + "/server.yml", "server:\n  port: 9090\n  timeout: 3000\n");
+    // 只修改日志级别,appender会被复用
+    write_file(dir + "/log.yml", "logs:\n  - name: test_watcher\n    level: debug\n    appenders:\n"
+                                 "      - type: StdoutLogAppender\n");
+    sleep(1);
+    SYLAR_LOG_DEBUG(logger) << "port=" << g_port->getValue() << " timeout=" << g_timeout->getValue()
+                            << " appender reused=" << (logger->getAppenders()->at(0) == appender);
+
+    watcher->stop();
+    iom.stop();
+    return 0;
+}
@@ -0,0 +1,136 @@
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <assert.h>
+#include "log.h"
+#include "scheduler.h"
+#include "fiber_future.h"
+
+/**
+ * @brief 协程结果与等待
+ * 在协程中等待子任务(get/WhenAll/WhenAny/WaitGroup)只挂起协程,不阻塞线程,
+ * 子任务抛出的异常在get()时重新抛出
+ */
+
+static sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
+
+// 分发-汇总:一个请求拆成多个子任务,等待全部完成后合并结果
+void scatter_gather(sylar::Scheduler *sc)
+{
+    std::vector<sylar::FiberFuture<int>> futures;
+    for (int i = 0; i < 10; ++i)
+    {
+        futures.push_back(sc->scheduleFuture([i]()
+                                             {
+                                                 usleep(1000);
+                                                 if (i == 7)
+                                                 {
+                                                     throw std::runtime_error("shard 7 failed");
+                                                 }
+                                                 return i * i; }));
+    }
+    sylar::WhenAll(futures);
+    int sum = 0;
+    int errors = 0;
+    for (auto &i : futures)
+    {
+        try
+        {
+            sum += i.get();
+        }
+        catch (std::exception &ex)
+        {
+            ++errors;
+            SYLAR_LOG_INFO(g_logger) << "sub task error: " << ex.what();
+        }
+    }
+    SYLAR_LOG_INFO(g_logger) << "scatter gather sum=" << sum;
+    // 0..9的平方和为285,去掉失败的7*7
+    assert(sum == 285 - 49);
+    assert(errors == 1);
+}
+
+// 多个副本,取最先返回的结果
+void first_reply(sylar::Scheduler *sc)
+{
+    std::vector<sylar::FiberFuture<std::string>> futures;
+    for (int i = 0; i < 3; ++i)
+    {
+        futures.push_back(sc->scheduleFuture([i]()
+                                             {
+                                                 usleep((i + 1) * 1000);
+                                                 return "replica " + std::to_string(i); }));
+    }
+    int index = sylar::WhenAny(futures);
+    assert(index >= 0 && index < 3);
+    std::string value = futures[index].get();
+    SYLAR_LOG_INFO(g_logger) << "first reply index=" << index << " value=" << value;
+    assert(value == "replica " + std::to_string(index));
+    sylar::WhenAll(futures);
+}
+
+void wait_group(sylar::Scheduler *sc)
+{
+    sylar::WaitGroup wg;
+    std::atomic<int> count = {0};
+    wg.add(100);
+    for (int i = 0; i < 100; ++i)
+    {
+        sc->schedule([&wg, &count]()
+                     {
+                         ++count;
+                         wg.done(); });
+    }
+    wg.wait();
+    SYLAR_LOG_INFO(g_logger) << "wait group count=" << count;
+    assert(count == 100);
+}
+
+// 等待已创建的协程结束,协程中抛出的异常交给get(),协程本身正常结束
+void join_fiber(sylar::Scheduler *sc)
+{
+    int value = 0;
+    sylar::Fiber::ptr ok(new sylar::Fiber([&value]()
+                                          {
+                                              sylar::Fiber::YieldToReady();
+                                              value = 42; }));
+    sylar::Fiber::ptr bad(new sylar::Fiber([]()
+                                           { throw std::runtime_error("fiber failed"); }));
+    auto ok_future = sc->scheduleFuture(ok);
+    auto bad_future = sc->scheduleFuture(bad);
+    ok_future.get();
+    assert(value == 42);
+    bool caught = false;
+    try
+    {
+        bad_future.get();
+    }
+    catch (std::exception &ex)
+    {
+        caught = true;
+        SYLAR_LOG_INFO(g_logger) << "joined fiber error: " << ex.what();
+    }
+    assert(caught);
+    assert(ok->getState() == sylar::Fiber::TERM);
+    assert(bad->getState() == sylar::Fiber::TERM);
+}
+
+int main(int argc, char **argv)
+{
+    // 单线程调度器:等待的协程挂起后,同一个线程继续执行子任务
+    sylar::Scheduler sc(1, false, "future");
+    sc.start();
+
+    auto handler = sc.scheduleFuture([&sc]()
+                                     {
+                                         scatter_gather(&sc);
+                                         first_reply(&sc);
+                                         wait_group(&sc);
+                                         join_fiber(&sc); });
+    // 不在调度器中的线程等待时阻塞线程
+    handler.get();
+    SYLAR_LOG_INFO(g_logger) << "handler done";
+
+    sc.stop();
+    return 0;
+}
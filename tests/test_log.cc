@@ -2,6 +2,120 @@
 #include <iostream>
 #include "log.h"
 #include "util.h"
+#include <assert.h>
+#include <unistd.h>
+
+// 统计汇总日志的appender
+class SummaryAppender : public sylar::LogAppender
+{
+public:
+    void log(sylar::Logger::ptr logger, sylar::LogLevel::Level level, sylar::LogEvent::ptr event) override
+    {
+        if (event->getContent().find("suppressed") == 0)
+        {
+            ++summaries;
+            lines.push_back(event->getLine());
+        }
+        else
+        {
+            ++messages;
+        }
+    }
+    std::string toYamlString() override { return ""; }
+
+    int messages = 0;
+    int summaries = 0;
+    std::vector<int32_t> lines;
+};
+
+void log_site(sylar::Logger::ptr logger, int i)
+{
+    SYLAR_LOG_ERROR(logger) << "shared site i=" << i;
+}
+
+// 调用点安静后，丢弃条数由该日志器之后的其他日志汇报；同一调用点的不同日志器分别限流
+void test_quiet_site()
+{
+    SummaryAppender *appender = new SummaryAppender;
+    sylar::Logger::ptr a(new sylar::Logger("limit_a", sylar::LogLevel::DEBUG));
+    sylar::Logger::ptr b(new sylar::Logger("limit_b", sylar::LogLevel::DEBUG));
+    a->addAppender(sylar::LogAppender::ptr(appender));
+    a->setLimit(1, 1, 0);
+    b->setLimit(1, 1, 0);
+    int quiet_line = 0;
+    for (int i = 0; i < 100; ++i)
+    {
+        quiet_line = __LINE__ + 1;
+        SYLAR_LOG_ERROR(a) << "burst i=" << i;
+    }
+    assert(appender->messages == 1);
+    // b先经过调用点，不会占用a的令牌
+    log_site(b, 0);
+    log_site(a, 0);
+    assert(appender->messages == 2);
+    sleep(1);
+    SYLAR_LOG_ERROR(a) << "another site";
+    assert(appender->summaries == 1);
+    assert(appender->lines[0] == quiet_line);
+
+    // 整个日志器都安静时手动汇总
+    log_site(a, 1);
+    log_site(a, 2);
+    a->flushSuppressed();
+    assert(appender->summaries == 2);
+    a->flushSuppressed();
+    assert(appender->summaries == 2);
+}
+
+void log_replaced_site(sylar::Logger::ptr logger)
+{
+    SYLAR_LOG_ERROR(logger) << "replaced site";
+}
+
+// 日志器被替换后(新对象可能复用同一地址)，新日志器不使用旧日志器的调用点状态
+void test_replaced_logger()
+{
+    for (int i = 0; i < 3; ++i)
+    {
+        SummaryAppender *appender = new SummaryAppender;
+        sylar::Logger::ptr logger(new sylar::Logger("limit_replaced", sylar::LogLevel::DEBUG));
+        logger->addAppender(sylar::LogAppender::ptr(appender));
+        logger->setLimit(1, 1, 0);
+        // 每个新日志器的第一条都有令牌
+        log_replaced_site(logger);
+        assert(appender->messages == 1);
+    }
+}
+
+// 记录析构的appender
+class DtorAppender : public sylar::LogAppender
+{
+public:
+    DtorAppender(bool &destroyed) : m_destroyed(destroyed) {}
+    ~DtorAppender() { m_destroyed = true; }
+    void log(sylar::Logger::ptr, sylar::LogLevel::Level, sylar::LogEvent::ptr) override {}
+    std::string toYamlString() override { return ""; }
+
+private:
+    bool &m_destroyed;
+};
+
+// 不在调度器中移除appender,返回前旧列表已经释放,appender随之析构(关闭文件)
+void test_remove_appender()
+{
+    bool del_destroyed = false;
+    bool clear_destroyed = false;
+    sylar::Logger::ptr logger(new sylar::Logger("remove", sylar::LogLevel::DEBUG));
+    sylar::LogAppender::ptr appender(new DtorAppender(del_destroyed));
+    logger->addAppender(appender);
+    logger->addAppender(sylar::LogAppender::ptr(new DtorAppender(clear_destroyed)));
+    SYLAR_LOG_INFO(logger) << "to appenders";
+    logger->delAppender(appender);
+    appender.reset();
+    assert(del_destroyed);
+    logger->clearAppenders();
+    assert(clear_destroyed);
+}
 
 int main()
 {
@@ -41,6 +155,19 @@ int main()
     SYLAR_LOG_ERROR(logger) << "test error";
     SYLAR_LOG_FATAL(logger) << "test fatal";
 
+    // 限流: 每个调用点每秒最多5条，采样: 每2条保留1条，每秒输出一条被丢弃条数的汇总
+    logger->setLimit(5, 5, 2);
+    time_t end = time(0) + 3;
+    for (int i = 0; time(0) < end; ++i)
+    {
+        SYLAR_LOG_ERROR(logger) << "test limit i=" << i;
+    }
+    logger->setLimit(0, 0, 0);
+
+    test_quiet_site();
+    test_replaced_logger();
+    test_remove_appender();
+
     // SYLAR_LOG_FMT_ERROR(logger, "test macro fmt error %s", "aa");
     // auto l = sylar::LoggerMgr::GetInstance()->getLogger("xx");
     // SYLAR_LOG_INFO(l) << "xxx";
@@ -0,0 +1,61 @@
+#include <iostream>
+#include <assert.h>
+#include <unistd.h>
+#include "log.h"
+#include "log_binary.h"
+
+/**
+ * @brief 写入二进制日志，再读出还原为文本
+ * 也可以使用 sylar-logcat ./log.bin 查看
+ */
+
+int main(int argc, char **argv)
+{
+    std::string file = "./log.bin";
+    // 追加写,先删除上次运行的文件
+    unlink(file.c_str());
+    // 定义一个日志器
+    sylar::Logger::ptr logger(new sylar::Logger("logger_binary", sylar::LogLevel::DEBUG));
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::BinaryLogAppender(file)));
+    // 同时输出到控制台，对比还原结果
+    logger->addAppender(sylar::LogAppender::ptr(new sylar::StdoutLogAppender));
+
+    for (int i = 0; i < 3; ++i)
+    {
+        SYLAR_LOG_FMT_INFO(logger, "fmt int=%d str=%s double=%.2f hex=%#x", i, "hello", i * 1.5, 255);
+        SYLAR_LOG_INFO(logger) << "stream i=" << i;
+    }
+    std::string name = "zje";
+    SYLAR_LOG_FMT_ERROR(logger, "width=[%5d] [%-8s] [%*d] ll=%lld", 42, name, 6, 7, -1234567890123LL);
+    const int written = 3 * 2 + 1;
+    // 移除后appender析构,缓冲写入文件
+    logger->clearAppenders();
+
+    std::cout << "====== decode " << file << " ======" << std::endl;
+    sylar::LogFormatter::ptr fmt(new sylar::LogFormatter("%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n"));
+    sylar::BinaryLogReader reader(file);
+    sylar::LogEvent::ptr event;
+    int decoded = 0;
+    while (reader.read(event))
+    {
+        fmt->format(std::cout, event->getLogger(), event->getLevel(), event);
+        ++decoded;
+    }
+    std::cout << "decoded " << decoded << " of " << written << " records" << std::endl;
+    assert(decoded == written);
+
+    // 长度字段损坏(超过文件大小)时停止读取,不按它分配内存
+    std::string bad = "./log_bad.bin";
+    {
+        std::ofstream out(bad, std::ios::out | std::ios::trunc | std::ios::binary);
+        char type = sylar::BinaryLog::EVENT;
+        uint32_t len = 0xfffffff0;
+        out.write(&type, sizeof(type));
+        out.write((const char *)&len, sizeof(len));
+    }
+    sylar::BinaryLogReader bad_reader(bad);
+    assert(bad_reader.isOpen());
+    assert(!bad_reader.read(event));
+    unlink(bad.c_str());
+    return 0;
+}
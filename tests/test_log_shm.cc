@@ -0,0 +1,97 @@
+#include <iostream>
+#include <string>
+#include <chrono>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "log.h"
+#include "log_shm.h"
+
+/**
+ * @brief 共享内存日志
+ * ./test_log_shm writer /sylar_log   日志进程,每秒写一条日志
+ * ./test_log_shm reader /sylar_log   读进程,输出读到的日志
+ * ./test_log_shm                     fork出读进程,写入一批日志后统计读到的条数
+ */
+
+static const int COUNT = 100000;
+
+void run_writer(const std::string &name, int count, bool slow)
+{
+    sylar::Logger::ptr logger(new sylar::Logger("logger_shm", sylar::LogLevel::DEBUG));
+    sylar::ShmLogAppender::ptr appender(new sylar::ShmLogAppender(name));
+    logger->addAppender(appender);
+    for (int i = 0; i < count; ++i)
+    {
+        SYLAR_LOG_INFO(logger) << "shm log i=" << i;
+        if (slow)
+        {
+            sleep(1);
+        }
+    }
+    if (appender->getRing())
+    {
+        std::cout << "writer done, dropped=" << appender->getRing()->getDropped() << std::endl;
+    }
+}
+
+int run_reader(const std::string &name, int count)
+{
+    auto ring = sylar::ShmLogRing::Open(name);
+    if (!ring)
+    {
+        return -1;
+    }
+    std::string line;
+    int n = 0;
+    while (count < 0 || n < count)
+    {
+        // 2秒没有新日志认为写进程结束
+        if (!ring->read(line, count < 0 ? -1 : 2000))
+        {
+            break;
+        }
+        ++n;
+        if (count < 0)
+        {
+            std::cout << "receive from log shm " << line;
+        }
+    }
+    return n;
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 3)
+    {
+        std::string mode = argv[1];
+        if (mode == "writer")
+        {
+            run_writer(argv[2], INT32_MAX, true);
+        }
+        else
+        {
+            run_reader(argv[2], -1);
+        }
+        return 0;
+    }
+
+    std::string name = "/sylar_test_log_shm";
+    sylar::ShmLogRing::Unlink(name);
+    // 先创建好共享内存,保证读写进程映射同一块
+    auto ring = sylar::ShmLogRing::Open(name);
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        int n = run_reader(name, COUNT);
+        std::cout << "reader got " << n << " lines" << std::endl;
+        _exit(0);
+    }
+    auto start = std::chrono::steady_clock::now();
+    run_writer(name, COUNT, false);
+    std::cout << "writer " << COUNT << " lines cost "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+              << "ms" << std::endl;
+    waitpid(pid, nullptr, 0);
+    sylar::ShmLogRing::Unlink(name);
+    return 0;
+}
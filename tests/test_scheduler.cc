@@ -1,4 +1,6 @@
 #include <iostream>
+#include <sys/resource.h>
+#include <assert.h>
 #include "log.h"
 #include "scheduler.h"
 
@@ -22,6 +24,338 @@ void test_fiber_1()
     SYLAR_LOG_INFO(g_logger) << "test in fiber";
 }
 
+void test_priority()
+{
+    // 单线程调度器,先放入大量低优先级任务,再放入高优先级任务,高优先级任务会先执行
+    sylar::Scheduler sc(1, false, "priority");
+    std::atomic<int> low_done = {0};
+    int high_after = -1; // 高优先级任务执行时已完成的低优先级任务数
+    for (int i = 0; i < 1000; ++i)
+    {
+        sc.schedule([&low_done]()
+                    {
+                        usleep(100);
+                        ++low_done; }, -1, sylar::Scheduler::PRIORITY_LOW);
+    }
+    sc.schedule([&low_done, &high_after]()
+                {
+                    high_after = low_done;
+                    SYLAR_LOG_INFO(g_logger) << "health check"; }, -1, sylar::Scheduler::PRIORITY_HIGH);
+    sc.start();
+    sc.stop();
+    for (int i = 0; i < sylar::Scheduler::PRIORITY_COUNT; ++i)
+    {
+        auto stats = sc.getQueueStats((sylar::Scheduler::Priority)i);
+        SYLAR_LOG_INFO(g_logger) << "priority=" << i << " scheduled=" << stats.scheduled
+                                 << " max_depth=" << stats.maxDepth << " aged=" << stats.aged;
+    }
+    assert(high_after == 0);
+    assert(low_done == 1000);
+    assert(sc.getQueueStats(sylar::Scheduler::PRIORITY_HIGH).scheduled == 1);
+    assert(sc.getQueueStats(sylar::Scheduler::PRIORITY_LOW).scheduled == 1000);
+    assert(sc.getQueueStats(sylar::Scheduler::PRIORITY_LOW).maxDepth == 1000);
+}
+
+static std::atomic<int> s_high_count = {0};
+
+// 持续产生高优先级任务:先放入下一个再执行,高优先级队列一直不为空
+void high_stream()
+{
+    if (++s_high_count < 100)
+    {
+        sylar::Scheduler::GetThis()->schedule(&high_stream, -1, sylar::Scheduler::PRIORITY_HIGH);
+    }
+    usleep(1000);
+}
+
+void test_aging()
+{
+    // 高优先级任务源源不断时,低优先级任务等待超过老化时间后也能执行,不会饿死
+    sylar::Scheduler sc(1, false, "aging");
+    sc.setAging(10);
+    int high_before = -1; // 低优先级任务执行时已执行的高优先级任务数
+    uint64_t low_wait = 0;
+    uint64_t now = sylar::Scheduler::NowMs();
+    sc.schedule([&high_before, &low_wait, now]()
+                {
+                    high_before = s_high_count;
+                    low_wait = sylar::Scheduler::NowMs() - now; }, -1, sylar::Scheduler::PRIORITY_LOW);
+    sc.schedule(&high_stream, -1, sylar::Scheduler::PRIORITY_HIGH);
+    sc.start();
+    sc.stop();
+    auto stats = sc.getQueueStats(sylar::Scheduler::PRIORITY_LOW);
+    SYLAR_LOG_INFO(g_logger) << "low priority task ran after " << high_before << " high tasks, waited "
+                             << low_wait << "ms aged=" << stats.aged;
+    assert(s_high_count == 100);
+    // 低优先级有效等级为2*10ms,等待超过20ms后先于新的高优先级任务执行
+    assert(high_before > 0 && high_before < 100);
+    assert(low_wait >= 20);
+    assert(stats.aged == 1);
+}
+
+void test_wakeup()
+{
+    // 一个线程取走耗时的高优先级任务后,其他优先级队列中的任务应立即由空闲线程执行
+    sylar::Scheduler sc(3, false, "wakeup");
+    sc.start();
+    usleep(10000);
+    std::atomic<uint64_t> low_start = {0};
+    uint64_t now = sylar::Scheduler::NowMs();
+    sc.schedule([]()
+                { usleep(300000); }, -1, sylar::Scheduler::PRIORITY_HIGH);
+    sc.schedule([&low_start]()
+                { low_start = sylar::Scheduler::NowMs(); }, -1, sylar::Scheduler::PRIORITY_LOW);
+    // stop()会唤醒所有线程,等高优先级任务结束后再停止,避免掩盖漏掉的唤醒
+    usleep(400000);
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "low priority task delay=" << low_start - now << "ms";
+    assert(low_start);
+    assert(low_start - now < 100);
+}
+
+void test_deadline()
+{
+    // 截止时间较早的任务先执行;每个任务耗时2ms,截止时间来不及的任务改为执行超时回调
+    sylar::Scheduler sc(2, false, "deadline");
+    sc.setDeadlinePolicy(sylar::Scheduler::DEADLINE_CALLBACK);
+    std::atomic<int> timeout_count = {0};
+    uint64_t now = sylar::Scheduler::NowMs();
+    for (int i = 0; i < 200; ++i)
+    {
+        sc.scheduleWithDeadline([]()
+                                { usleep(2000); },
+                                now + 20 + i % 100, [&timeout_count]()
+                                { ++timeout_count; });
+    }
+    sc.start();
+    sc.stop();
+    auto stats = sc.getDeadlineStats();
+    SYLAR_LOG_INFO(g_logger) << "deadline scheduled=" << stats.scheduled << " met=" << stats.met
+                             << " missed=" << stats.missed << " shed=" << stats.shed
+                             << " stolen=" << stats.stolen << " timeout_cb=" << timeout_count;
+    // 2个线程执行200个2ms的任务约需200ms,截止时间在20~120ms之间,前面的按时执行,后面的超时
+    assert(stats.scheduled == 200);
+    assert(stats.met + stats.missed == 200);
+    assert(stats.met > 0 && stats.shed > 0);
+    assert(stats.shed == stats.missed);
+    assert(timeout_count == (int)stats.shed);
+}
+
+void test_deadline_order()
+{
+    // 单线程按截止时间从早到晚执行,与加入顺序无关,先于普通任务
+    sylar::Scheduler sc(1, false, "edf");
+    std::vector<uint64_t> order;
+    uint64_t now = sylar::Scheduler::NowMs();
+    sc.schedule([&order]()
+                { order.push_back(0); });
+    for (int i = 0; i < 50; ++i)
+    {
+        uint64_t deadline = now + 10000 + (i * 37) % 50;
+        sc.scheduleWithDeadline([&order, deadline]()
+                                { order.push_back(deadline); },
+                                deadline);
+    }
+    sc.start();
+    sc.stop();
+    assert(order.size() == 51);
+    assert(order.back() == 0);
+    for (size_t i = 1; i < 50; ++i)
+    {
+        assert(order[i - 1] <= order[i]);
+    }
+    auto stats = sc.getDeadlineStats();
+    assert(stats.scheduled == 50 && stats.met == 50 && stats.missed == 0);
+}
+
+void test_deadline_hold()
+{
+    // 截止时间任务让出(HOLD)后被重新调度,仍按截止时间先于普通任务执行
+    sylar::Scheduler sc(1, false, "deadline_hold");
+    std::atomic<int> normal_done = {0};
+    int resumed_after = -1; // 恢复执行时已完成的普通任务数
+    for (int i = 0; i < 10; ++i)
+    {
+        sc.schedule([&normal_done]()
+                    { ++normal_done; });
+    }
+    sc.scheduleWithDeadline([&sc, &normal_done, &resumed_after]()
+                            {
+                                // 在让出之前就重新调度,调度器等协程让出后再执行
+                                sc.schedule(sylar::Fiber::GetThis());
+                                sylar::Fiber::YieldToHold();
+                                resumed_after = normal_done; },
+                            sylar::Scheduler::NowMs() + 10000);
+    sc.start();
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "deadline fiber resumed after " << resumed_after << " normal tasks";
+    assert(resumed_after == 0);
+    assert(normal_done == 10);
+}
+
+void test_task()
+{
+    // 捕获不超过64字节的函数保存在Task内部,不申请内存,从schedule到协程执行只移动不复制
+    char small[48] = "small";
+    char large[128] = "large";
+    sylar::Task t1([small]()
+                   { SYLAR_LOG_INFO(g_logger) << small; });
+    sylar::Task t2([large]()
+                   { SYLAR_LOG_INFO(g_logger) << large; });
+    SYLAR_LOG_INFO(g_logger) << "small heap=" << t1.isHeap() << " large heap=" << t2.isHeap();
+    assert(!t1.isHeap());
+    assert(t2.isHeap());
+    // 正好64字节的捕获仍在内部,多1字节就放到堆上
+    char inline_max[sylar::Task::INLINE_SIZE] = {0};
+    char heap_min[sylar::Task::INLINE_SIZE + 1] = {0};
+    sylar::Task t3([inline_max]()
+                   { (void)inline_max; });
+    sylar::Task t4([heap_min]()
+                   { (void)heap_min; });
+    assert(!t3.isHeap());
+    assert(t4.isHeap());
+    // 移动后仍在内部缓冲区,原任务置空
+    sylar::Task t5(std::move(t3));
+    assert(t5 && !t5.isHeap() && !t3);
+
+    sylar::Scheduler sc(1, false, "task");
+    std::atomic<uint64_t> sum = {0};
+    uint64_t start = sylar::Scheduler::NowMs();
+    for (int i = 0; i < 100000; ++i)
+    {
+        uint64_t a = i, b = i * 2, c = i * 3;
+        sc.schedule([&sum, a, b, c]()
+                    { sum += a + b + c; });
+    }
+    sc.schedule(std::move(t1));
+    assert(!t1);
+    // 只能移动的捕获(unique_ptr)从schedule一直移动到执行,执行的是同一个对象
+    std::unique_ptr<int> payload(new int(42));
+    int *payload_addr = payload.get();
+    bool payload_ok = false;
+    sc.schedule([payload = std::move(payload), payload_addr, &payload_ok]()
+                { payload_ok = payload.get() == payload_addr && *payload == 42; });
+    sc.start();
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "100000 tasks sum=" << sum << " " << sylar::Scheduler::NowMs() - start << "ms";
+    assert(sum == 6ull * (99999ull * 100000 / 2));
+    assert(payload_ok);
+}
+
+void test_fiber_pool()
+{
+    // 函数任务执行中让出,调度线程从协程池中取已结束的协程执行下一个函数,不再为每个任务分配协程栈
+    // 每批10个任务执行完再放入下一批,同时存在的协程不超过协程池大小,只有第一批需要新建协程
+    const uint32_t pool_size = 16;
+    sylar::Scheduler sc(1, false, "pool");
+    sc.setFiberPoolSize(pool_size);
+    sc.start();
+    std::atomic<int> done = {0};
+    for (int i = 0; i < 10000; ++i)
+    {
+        sc.schedule([&done]()
+                    {
+                        sylar::Fiber::YieldToReady();
+                        ++done; });
+        if (i % 10 == 9)
+        {
+            while (done <= i)
+            {
+                usleep(100);
+            }
+        }
+    }
+    sc.stop();
+    auto stats = sc.getFiberPoolStats();
+    SYLAR_LOG_INFO(g_logger) << "fiber pool hit=" << stats.hit << " miss=" << stats.miss
+                             << " recycled=" << stats.recycled;
+    assert(done == 10000);
+    assert(stats.hit + stats.miss == 10000);
+    assert(stats.miss <= pool_size);
+
+    // 不缓存时每个让出的函数任务都要新建协程
+    sylar::Scheduler nopool(1, false, "nopool");
+    nopool.setFiberPoolSize(0);
+    for (int i = 0; i < 100; ++i)
+    {
+        nopool.schedule([]()
+                        { sylar::Fiber::YieldToReady(); });
+    }
+    nopool.start();
+    nopool.stop();
+    stats = nopool.getFiberPoolStats();
+    assert(stats.miss == 100 && stats.hit == 0 && stats.recycled == 0);
+}
+
+void test_yield()
+{
+    // 协程反复让出重新入队,协程直接链接在调度器的侵入式队列中,入队出队不修改引用计数
+    uint64_t fibers = sylar::Fiber::TotalFibers();
+    std::atomic<int> yields = {0};
+    {
+        sylar::Scheduler sc(1, false, "yield");
+        for (int i = 0; i < 4; ++i)
+        {
+            sc.schedule([&yields]()
+                        {
+                            // 每次让出、重新入队、再次执行之后,协程的引用数不变
+                            long refs = sylar::Fiber::GetThis().use_count();
+                            for (int j = 0; j < 100000; ++j)
+                            {
+                                sylar::Fiber::YieldToReady();
+                                ++yields;
+                                if (j % 1000 == 0)
+                                {
+                                    assert(sylar::Fiber::GetThis().use_count() == refs);
+                                }
+                            } });
+        }
+        uint64_t start = sylar::Scheduler::NowMs();
+        sc.start();
+        sc.stop();
+        SYLAR_LOG_INFO(g_logger) << "400000 yields " << sylar::Scheduler::NowMs() - start << "ms";
+    }
+    assert(yields == 400000);
+    // 调度器析构后所有协程都已释放,没有遗漏的引用
+    assert(sylar::Fiber::TotalFibers() == fibers);
+}
+
+void test_batch()
+{
+    // 请求处理函数一次提交500个子任务,一次加锁放入队列,只唤醒需要数量的空闲线程
+    sylar::Scheduler sc(4, false, "batch");
+    sc.start();
+    std::atomic<int> done = {0};
+    sc.schedule([&sc, &done]()
+                {
+                    std::vector<sylar::Task> tasks;
+                    for (int i = 0; i < 500; ++i)
+                    {
+                        tasks.emplace_back([&done]()
+                                           { ++done; });
+                    }
+                    sc.scheduleBatch(std::move(tasks)); });
+    sc.stop();
+    SYLAR_LOG_INFO(g_logger) << "batch done=" << done;
+    assert(done == 500);
+
+    // 迭代器版本复制元素,调用者的容器保持不变,空函数不加入
+    sylar::Scheduler sc2(2, false, "batch_iter");
+    std::atomic<int> iter_done = {0};
+    std::vector<std::function<void()>> cbs(10, [&iter_done]()
+                                           { ++iter_done; });
+    cbs[3] = nullptr;
+    sc2.schedule(cbs.begin(), cbs.end());
+    sc2.schedule(cbs.cbegin(), cbs.cend());
+    sc2.start();
+    sc2.stop();
+    assert(iter_done == 18);
+    for (size_t i = 0; i < cbs.size(); ++i)
+    {
+        assert((bool)cbs[i] == (i != 3));
+    }
+}
+
 int main(int argc, char **argv)
 {
     SYLAR_LOG_INFO(g_logger) << "main";
@@ -30,7 +364,17 @@ int main(int argc, char **argv)
 
     sc.start();
 
+    // 空闲线程在futex上睡眠,空闲期间几乎不占用CPU
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    uint64_t user_ms = usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000;
+    uint64_t sys_ms = usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000;
     sleep(2);
+    getrusage(RUSAGE_SELF, &usage);
+    user_ms = usage.ru_utime.tv_sec * 1000 + usage.ru_utime.tv_usec / 1000 - user_ms;
+    sys_ms = usage.ru_stime.tv_sec * 1000 + usage.ru_stime.tv_usec / 1000 - sys_ms;
+    SYLAR_LOG_INFO(g_logger) << "idle cpu " << user_ms << "ms user, " << sys_ms << "ms sys";
+    assert(user_ms + sys_ms < 100);
     SYLAR_LOG_INFO(g_logger) << "schedule";
 
     // 加入任务，可以执行该任务放到执行线程上执行
@@ -40,5 +384,16 @@ int main(int argc, char **argv)
     sc.stop();
     SYLAR_LOG_INFO(g_logger) << "over";
 
+    test_wakeup();
+    test_priority();
+    test_aging();
+    test_deadline();
+    test_deadline_order();
+    test_deadline_hold();
+    test_task();
+    test_fiber_pool();
+    test_yield();
+    test_batch();
+
     return 0;
 }
\ No newline at end of file
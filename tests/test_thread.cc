@@ -1,7 +1,10 @@
 #include "thread.h"
 #include "log.h"
+#include "scheduler.h"
 #include <iostream>
 #include <unistd.h>
+#include <assert.h>
+#include <chrono>
 
 
 void *myThreadID1(void *)
@@ -200,6 +203,267 @@ void fun2()
 {
 }
 
+void adaptive_mutex_test()
+{
+    // 多个线程竞争同一把自适应锁,输出竞争统计
+    static sylar::AdaptiveMutex s_mutex;
+    static int64_t s_count = 0;
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 8; i++)
+    {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([]()
+                                                             {
+            for (int j = 0; j < 1000000; ++j)
+            {
+                sylar::AdaptiveMutex::Lock lock(s_mutex);
+                ++s_count;
+            } }, "mutex_" + std::to_string(i))));
+    }
+    for (auto &i : thrs)
+    {
+        i->join();
+    }
+    auto stats = s_mutex.getStats();
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "count=" << s_count
+                                     << " acquisitions=" << stats.acquisitions
+                                     << " contended=" << stats.contended
+                                     << " parked=" << stats.parked
+                                     << " wait=" << stats.waitNs / 1000 << "us";
+    assert(s_count == 8 * 1000000);
+    // 加锁次数在持有锁时累加,不会丢失
+    assert(stats.acquisitions == (uint64_t)s_count);
+    assert(stats.contended <= stats.acquisitions);
+    assert(stats.parked <= stats.contended);
+}
+
+static int s_profile_line = 0;
+
+void lock_profile_test()
+{
+    // 需要使用-DSYLAR_LOCK_PROFILE=ON编译,输出等待时间最长的加锁位置
+    static sylar::Mutex s_mutex;
+    static sylar::RWMutex s_rwmutex;
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 4; i++)
+    {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([]()
+                                                             {
+            for (int j = 0; j < 100000; ++j)
+            {
+                {
+                    s_profile_line = __LINE__ + 1;
+                    sylar::Mutex::Lock lock(s_mutex);
+                    ++number;
+                }
+                sylar::RWMutex::ReadLock lock(s_rwmutex);
+            } }, "profile_" + std::to_string(i))));
+    }
+    for (auto &i : thrs)
+    {
+        i->join();
+    }
+    std::cout << sylar::LockProfiler::Dump() << std::endl;
+#ifdef SYLAR_LOCK_PROFILE
+    assert(sylar::LockProfiler::GetCount(__FILE__, s_profile_line) == 4 * 100000);
+#else
+    // 不开启时局部锁不记录
+    assert(sylar::LockProfiler::GetCount(__FILE__, s_profile_line) == 0);
+#endif
+
+    // 直接记录,多个线程的统计按位置合并
+    static const char *s_site = "profile_site.cc";
+    thrs.clear();
+    for (int i = 0; i < 4; i++)
+    {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([]()
+                                                             {
+            for (int j = 0; j < 1000; ++j)
+            {
+                sylar::LockProfiler::Record(s_site, 1, 100, 200);
+            } }, "record_" + std::to_string(i))));
+    }
+    for (auto &i : thrs)
+    {
+        i->join();
+    }
+    std::string dump = sylar::LockProfiler::Dump();
+    std::cout << dump << std::endl;
+    assert(sylar::LockProfiler::GetCount(s_site, 1) == 4000);
+    assert(dump.find("profile_site.cc:1\t4000\t") != std::string::npos);
+    sylar::LockProfiler::Reset();
+    assert(sylar::LockProfiler::GetCount(s_site, 1) == 0);
+}
+
+template <class RW>
+void rwmutex_bench(const std::string &name)
+{
+    // 读多写少,比较不同读写锁的耗时,每次写时检查没有读者
+    static RW s_rwmutex;
+    static int64_t s_value = 0;
+    static std::atomic<int64_t> s_bad{0};
+    static std::atomic<int64_t> s_writes{0};
+    auto start = std::chrono::steady_clock::now();
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 4; i++)
+    {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([i]()
+                                                             {
+            for (int j = 0; j < 1000000; ++j)
+            {
+                if (i == 0 && j % 10000 == 0)
+                {
+                    typename RW::WriteLock lock(s_rwmutex);
+                    s_value = -1;
+                    ++s_writes;
+                    s_value = j;
+                }
+                else
+                {
+                    typename RW::ReadLock lock(s_rwmutex);
+                    if (s_value < 0)
+                    {
+                        SYLAR_LOG_ERROR(SYLAR_LOG_ROOT()) << "read while writing";
+                        ++s_bad;
+                    }
+                }
+            } }, name + "_" + std::to_string(i))));
+    }
+    for (auto &i : thrs)
+    {
+        i->join();
+    }
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << name << " cost "
+                                     << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count()
+                                     << "ms";
+    // 读者不会看到写了一半的值,写者不会饿死
+    assert(s_bad == 0);
+    assert(s_writes == 100);
+}
+
+struct RcuData
+{
+    int64_t a = 0;
+    int64_t b = 0;
+    ~RcuData() { a = -1; }
+};
+
+void seqlock_rcu_test()
+{
+    struct Pair
+    {
+        int64_t a;
+        int64_t b;
+    };
+    // 写线程持续修改,读线程检查读到的值总是一致的,旧对象不会在读者使用时被释放
+    static sylar::SeqLock<Pair> s_pair(Pair{0, 0});
+    static std::atomic<RcuData *> s_data{new RcuData};
+    static std::atomic<bool> s_stop{false};
+    static std::atomic<int64_t> s_bad{0};
+    std::vector<sylar::Thread::ptr> thrs;
+    for (int i = 0; i < 3; i++)
+    {
+        thrs.push_back(sylar::Thread::ptr(new sylar::Thread([]()
+                                                             {
+            while (!s_stop)
+            {
+                Pair p = s_pair.load();
+                sylar::Rcu::ReadLock lock;
+                RcuData *data = s_data.load(std::memory_order_acquire);
+                if (p.a != p.b || data->a < 0 || data->a != data->b)
+                {
+                    ++s_bad;
+                }
+            } }, "reader_" + std::to_string(i))));
+    }
+    for (int64_t i = 1; i <= 100000; ++i)
+    {
+        s_pair.store(Pair{i, i});
+        RcuData *data = new RcuData;
+        data->a = data->b = i;
+        sylar::Rcu::Retire(s_data.exchange(data));
+        // 写线程不在调度器中,定期推进释放
+        sylar::Rcu::QuiescentPoint();
+    }
+    s_stop = true;
+    for (auto &i : thrs)
+    {
+        i->join();
+    }
+    sylar::Rcu::Synchronize();
+    SYLAR_LOG_INFO(SYLAR_LOG_ROOT()) << "bad=" << s_bad << " pending=" << sylar::Rcu::GetPending();
+    assert(s_bad == 0);
+    assert(sylar::Rcu::GetPending() == 0);
+}
+
+void rcu_reader_test()
+{
+    // 回调只在Retire之前进入读临界区的读者全部退出后才执行
+    static std::atomic<bool> s_entered{false};
+    static std::atomic<bool> s_exit{false};
+    std::atomic<bool> retired{false};
+    sylar::Thread::ptr reader(new sylar::Thread([]()
+                                                {
+        sylar::Rcu::ReadLock lock;
+        s_entered = true;
+        while (!s_exit)
+        {
+            usleep(1000);
+        } }, "rcu_reader"));
+    while (!s_entered)
+    {
+        usleep(1000);
+    }
+    sylar::Rcu::Retire([&retired]()
+                       { retired = true; });
+    for (int i = 0; i < 100; ++i)
+    {
+        sylar::Rcu::QuiescentPoint();
+    }
+    assert(!retired);
+    s_exit = true;
+    reader->join();
+    sylar::Rcu::Synchronize();
+    assert(retired);
+
+    // 调度器的线程都在睡眠时,Retire唤醒空闲线程推进释放,不需要其他线程调用QuiescentPoint
+    sylar::Scheduler sc(2, false, "rcu");
+    sc.start();
+    usleep(100 * 1000);
+    retired = false;
+    sylar::Rcu::Retire([&retired]()
+                       { retired = true; });
+    for (int i = 0; i < 100 && !retired; ++i)
+    {
+        usleep(10 * 1000);
+    }
+    assert(retired);
+    sc.stop();
+
+    // 不在调度器中的写者:RcuPtr替换后Collect同步等待,返回前旧对象已经析构
+    static std::atomic<int> s_alive{0};
+    struct Counted
+    {
+        Counted() { ++s_alive; }
+        ~Counted() { --s_alive; }
+    };
+    {
+        sylar::RcuPtr<Counted> p(std::make_shared<Counted>());
+        p.store(std::make_shared<Counted>());
+        sylar::Rcu::Collect();
+        assert(s_alive == 1);
+    }
+    assert(s_alive == 0);
+
+    // 线程退出时执行它Retire的回调,不会留到进程结束
+    retired = false;
+    sylar::Thread::ptr writer(new sylar::Thread([&retired]()
+                                                { sylar::Rcu::Retire([&retired]()
+                                                                     { retired = true; }); }, "rcu_writer"));
+    writer->join();
+    assert(retired);
+    assert(sylar::Rcu::GetPending() == 0);
+}
+
 int main()
 {
     sylar::Logger::ptr g_logger = SYLAR_LOG_ROOT();
@@ -221,6 +485,12 @@ int main()
     // p_thread_test();
     // p_thread_sync_test_1();
     // p_thread_rwlock_test();
+    adaptive_mutex_test();
+    lock_profile_test();
+    rwmutex_bench<sylar::RWMutex>("rwmutex");
+    rwmutex_bench<sylar::BrRWMutex>("br_rwmutex");
+    seqlock_rcu_test();
+    rcu_reader_test();
 
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,41 @@
+#include <iostream>
+#include "log.h"
+#include "log_binary.h"
+
+/**
+ * @brief 二进制日志解码工具
+ * 读取BinaryLogAppender写出的文件，按照LogFormatter的模板还原为文本输出到控制台
+ *
+ * usage: sylar-logcat <binary_log_file> [pattern]
+ */
+
+int main(int argc, char **argv)
+{
+    if (argc < 2)
+    {
+        std::cout << "usage: sylar-logcat <binary_log_file> [pattern]" << std::endl;
+        return -1;
+    }
+    // 默认格式与Logger一致
+    std::string pattern = argc > 2 ? argv[2] : "%d{%Y-%m-%d %H:%M:%S}%T%t%T%N%T%F%T[%p]%T[%c]%T%f:%l%T%m%n";
+    sylar::LogFormatter::ptr formatter(new sylar::LogFormatter(pattern));
+    if (formatter->isError())
+    {
+        std::cout << "invalid pattern: " << pattern << std::endl;
+        return -1;
+    }
+
+    sylar::BinaryLogReader reader(argv[1]);
+    if (!reader.isOpen())
+    {
+        std::cout << "open " << argv[1] << " failed" << std::endl;
+        return -1;
+    }
+
+    sylar::LogEvent::ptr event;
+    while (reader.read(event))
+    {
+        formatter->format(std::cout, event->getLogger(), event->getLevel(), event);
+    }
+    return 0;
+}